@@ -0,0 +1,105 @@
+/*
+ * Throughput benchmark for batch decoding of raw register words.
+ *
+ * Decodes a large array of random words with the scalar decode_register()
+ * loop and with decode_register_batch(), checks that both agree and reports
+ * words per second for each register of the REGISTERS table.
+ *
+ * Build and run:
+ *   gcc -O2 bench/decode_bench.c -o bench/decode_bench -lpci -lz -lpthread -ldl -lm \
+ *     -I/path/to/cuda/include
+ *   ./bench/decode_bench [--words 67108864] [--rounds 5]
+ */
+
+#define main gputemps_main
+#include "../gputemps.c"
+#undef main
+
+#define DEFAULT_WORDS (64u << 20)
+#define DEFAULT_ROUNDS 5
+
+static double seconds_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Kept scalar so the baseline is one word at a time, as in read_register_temp(). */
+__attribute__((optimize("no-tree-vectorize")))
+static void decode_scalar(const RegisterField *reg, const uint32_t *raw,
+                          uint8_t *temps, uint8_t *valid, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        temps[i] = (uint8_t)decode_register(reg, raw[i]);
+        valid[i] = temps[i] < 0x7f;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    size_t words = DEFAULT_WORDS;
+    unsigned int rounds = DEFAULT_ROUNDS;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--words") == 0 && i + 1 < argc) {
+            words = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--rounds") == 0 && i + 1 < argc) {
+            rounds = (unsigned int)strtoul(argv[++i], NULL, 10);
+        } else {
+            fprintf(stderr, "Usage: %s [--words N] [--rounds N]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (words == 0 || rounds == 0) return 1;
+
+    uint32_t *raw = malloc(words * sizeof(uint32_t));
+    uint8_t *scalar_temps = malloc(words);
+    uint8_t *scalar_valid = malloc(words);
+    uint8_t *batch_temps = malloc(words);
+    uint8_t *batch_valid = malloc(words);
+    if (!raw || !scalar_temps || !scalar_valid || !batch_temps || !batch_valid) {
+        fprintf(stderr, "Failed to allocate %zu words\n", words);
+        return 1;
+    }
+
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    for (size_t i = 0; i < words; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        raw[i] = (uint32_t)state;
+    }
+
+    printf("%-10s %12s %14s %14s %8s\n", "REGISTER", "WORDS", "SCALAR_W/S", "BATCH_W/S", "SPEEDUP");
+    int failed = 0;
+    for (int reg = 0; reg < REG_COUNT; reg++) {
+        double scalar_best = 0, batch_best = 0;
+        for (unsigned int round = 0; round < rounds; round++) {
+            struct timespec start;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            decode_scalar(&REGISTERS[reg], raw, scalar_temps, scalar_valid, words);
+            double scalar = seconds_since(&start);
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            decode_register_batch(&REGISTERS[reg], raw, batch_temps, batch_valid, words);
+            double batch = seconds_since(&start);
+
+            if (round == 0 || scalar < scalar_best) scalar_best = scalar;
+            if (round == 0 || batch < batch_best) batch_best = batch;
+        }
+
+        if (memcmp(scalar_temps, batch_temps, words) != 0 ||
+            memcmp(scalar_valid, batch_valid, words) != 0) {
+            fprintf(stderr, "Batch and scalar decoding of %s differ\n", REGISTERS[reg].name);
+            failed = 1;
+        }
+
+        printf("%-10s %12zu %14.3e %14.3e %7.2fx\n", REGISTERS[reg].name, words,
+            words / scalar_best, words / batch_best, scalar_best / batch_best);
+    }
+
+    free(raw);
+    free(scalar_temps);
+    free(scalar_valid);
+    free(batch_temps);
+    free(batch_valid);
+    return failed;
+}
@@ -0,0 +1,199 @@
+/*
+ * Scaling benchmark for the sampling and serialization pipeline.
+ *
+ * Runs the JSON snapshot path of gputemps against an increasing number of
+ * simulated GPUs (see mock/nvml_mock.c) and reports per-snapshot latency,
+ * throughput, heap allocations and RSS for each device count. Each count runs
+ * in its own process, since the mock sizes its devices when it is loaded.
+ *
+ * Build and run:
+ *   gcc -O2 bench/scale_bench.c -o bench/scale_bench -lpci -lz -lpthread -ldl -lm \
+ *     -I/path/to/cuda/include
+ *   LD_LIBRARY_PATH=mock ./bench/scale_bench [--counts 8,64,512,4096] [--seconds 2]
+ */
+
+#define main gputemps_main
+#include "../gputemps.c"
+#undef main
+
+#include <stdatomic.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define DEFAULT_COUNTS "8,64,512,4096"
+#define DEFAULT_SECONDS 2.0
+#define MIN_SNAPSHOTS 5
+#define MAX_SNAPSHOTS 100000
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static atomic_ulong alloc_count;
+static atomic_ulong alloc_bytes;
+
+void *malloc(size_t size) {
+    atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&alloc_bytes, size, memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&alloc_bytes, count * size, memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    atomic_fetch_add_explicit(&alloc_count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&alloc_bytes, size, memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    __libc_free(ptr);
+}
+
+static double elapsed_us(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1e6 + (end->tv_nsec - start->tv_nsec) / 1e3;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static long current_rss_kib(void) {
+    long pages = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f) return -1;
+    if (fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = -1;
+    fclose(f);
+    return resident < 0 ? -1 : resident * (PG_SZ / 1024);
+}
+
+static int run_child(double seconds) {
+    Context ctx = {0};
+    ctx.output_format = FORMAT_JSON;
+    ctx.output_mode = MODE_CONTINUOUS;
+    ctx.output = stdout;
+    ctx.self.syscall_fd = -1;
+    ctx.self.statm_fd = -1;
+    ctx.base = ctx.config = DEFAULT_CONFIG;
+    ctx.sysfs_root = SYSFS_ROOT;
+
+    if (!freopen("/dev/null", "w", stdout) || init_monitoring(&ctx) < 0) {
+        cleanup_context(&ctx);
+        return 1;
+    }
+
+    static double latencies[MAX_SNAPSHOTS];
+    struct timespec start, end, begin;
+    size_t snapshots = 0;
+    size_t bytes = 0;
+
+    if (monitor_temperatures_json(&ctx) != 0) {
+        cleanup_context(&ctx);
+        return 1;
+    }
+
+    unsigned long allocs_before = atomic_load(&alloc_count);
+    unsigned long alloc_bytes_before = atomic_load(&alloc_bytes);
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    do {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (monitor_temperatures_json(&ctx) != 0) {
+            cleanup_context(&ctx);
+            return 1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        latencies[snapshots++] = elapsed_us(&start, &end);
+        bytes += ctx.buffer_pos + 1;
+    } while (snapshots < MAX_SNAPSHOTS &&
+             (snapshots < MIN_SNAPSHOTS || elapsed_us(&begin, &end) < seconds * 1e6));
+
+    double total_us = elapsed_us(&begin, &end);
+    unsigned long allocs = atomic_load(&alloc_count) - allocs_before;
+    unsigned long allocated = atomic_load(&alloc_bytes) - alloc_bytes_before;
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    qsort(latencies, snapshots, sizeof(double), compare_double);
+    double mean = 0;
+    for (size_t i = 0; i < snapshots; i++) mean += latencies[i];
+    mean /= snapshots;
+
+    fprintf(stderr, "%6u %9zu %11.1f %11.1f %11.1f %9.1f %11.0f %9.1f %11.1f %9.1f %9ld %9ld\n",
+        ctx.device_count, snapshots, mean,
+        latencies[snapshots / 2],
+        latencies[(size_t)(snapshots * 0.99)],
+        snapshots / (total_us / 1e6),
+        snapshots * (double)ctx.device_count / (total_us / 1e6),
+        (double)bytes / snapshots / 1024.0,
+        (double)allocs / snapshots,
+        (double)allocated / snapshots / 1024.0,
+        current_rss_kib(), usage.ru_maxrss);
+
+    cleanup_context(&ctx);
+    return 0;
+}
+
+static int run_count(const char *self, const char *count, double seconds) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "Failed to fork: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (pid == 0) {
+        char duration[32];
+        snprintf(duration, sizeof(duration), "%g", seconds);
+        setenv("GPUTEMPS_MOCK_GPUS", count, 1);
+        unsetenv(MEM_PATH_ENV);
+        unsetenv(PCI_DUMP_ENV);
+        execl(self, self, "--child", duration, (char *)NULL);
+        fprintf(stderr, "Failed to exec %s: %s\n", self, strerror(errno));
+        _exit(127);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "Benchmark with %s GPUs failed\n", count);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *counts = DEFAULT_COUNTS;
+    double seconds = DEFAULT_SECONDS;
+
+    if (argc == 3 && strcmp(argv[1], "--child") == 0)
+        return run_child(atof(argv[2]));
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--counts") == 0 && i + 1 < argc) {
+            counts = argv[++i];
+        } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [--counts 8,64,512,4096] [--seconds 2]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    fprintf(stderr, "%6s %9s %11s %11s %11s %9s %11s %9s %11s %9s %9s %9s\n",
+        "GPUS", "SNAPSHOTS", "MEAN_US", "P50_US", "P99_US", "SNAP/S", "GPU/S",
+        "OUT_KIB", "ALLOCS", "ALLOC_KIB", "RSS_KIB", "MAXRSS");
+
+    char list[256];
+    snprintf(list, sizeof(list), "%s", counts);
+    int failed = 0;
+    for (char *save, *count = strtok_r(list, ",", &save); count;
+         count = strtok_r(NULL, ",", &save)) {
+        if (run_count("/proc/self/exe", count, seconds) < 0) failed = 1;
+    }
+    return failed;
+}
@@ -7,18 +7,204 @@
 #include <nvml.h>
 #include <errno.h>
 #include <string.h>
+#include <math.h>
 #include <stdarg.h>
 #include <signal.h>
 #include <termios.h>
 #include <time.h>
+#include <sys/resource.h>
+#include <sys/ioctl.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+#include <sys/prctl.h>
+#include <linux/perf_event.h>
+#include <stdatomic.h>
+#include <dlfcn.h>
+#include <ctype.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <zlib.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/socket.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/* USDT probes compile to a nop unless a tracer attaches; the semaphores let
+ * the costlier probe arguments be skipped entirely when nobody listens.
+ * Build with -DGPUTEMPS_NO_USDT to drop them. */
+#if !defined(GPUTEMPS_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#define GPUTEMPS_USDT 1
+#endif
+#endif
+
+#ifdef GPUTEMPS_USDT
+#define PROBE_SEMAPHORE(name) \
+    __extension__ unsigned short gputemps_##name##_semaphore \
+    __attribute__((unused)) __attribute__((section(".probes")))
+#define PROBE_ENABLED(name) __builtin_expect(gputemps_##name##_semaphore != 0, 0)
+#define PROBE1(name, a) DTRACE_PROBE1(gputemps, name, a)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(gputemps, name, a, b, c)
+#define PROBE4(name, a, b, c, d) DTRACE_PROBE4(gputemps, name, a, b, c, d)
+#define PROBE5(name, a, b, c, d, e) DTRACE_PROBE5(gputemps, name, a, b, c, d, e)
+#else
+#define PROBE_SEMAPHORE(name) extern int gputemps_##name##_semaphore_unused
+#define PROBE_ENABLED(name) 0
+#define PROBE1(name, a) do {} while (0)
+#define PROBE3(name, a, b, c) do {} while (0)
+#define PROBE4(name, a, b, c, d) do {} while (0)
+#define PROBE5(name, a, b, c, d, e) do {} while (0)
+#endif
+
+PROBE_SEMAPHORE(sample_start);
+PROBE_SEMAPHORE(sample_end);
+PROBE_SEMAPHORE(register_read);
+PROBE_SEMAPHORE(nvml_call);
+PROBE_SEMAPHORE(snapshot_publish);
+
+/* NVML is loaded with dlopen() when the nvidia backend starts, so the hwmon
+ * backend runs on hosts without the NVIDIA driver. The symbols are the ones
+ * nvml.h maps each name to, e.g. nvmlInit_v2. Optional ones are left NULL
+ * when the driver is too old to have them. */
+#define NVML_LIBRARY "libnvidia-ml.so.1"
+#define NVML_FUNCTIONS(X) \
+    X(nvmlInit, 1) \
+    X(nvmlShutdown, 1) \
+    X(nvmlErrorString, 1) \
+    X(nvmlDeviceGetCount, 1) \
+    X(nvmlDeviceGetHandleByIndex, 1) \
+    X(nvmlDeviceGetHandleByPciBusId, 1) \
+    X(nvmlDeviceGetHandleByUUID, 1) \
+    X(nvmlDeviceGetIndex, 1) \
+    X(nvmlDeviceGetPciInfo, 1) \
+    X(nvmlDeviceGetUUID, 1) \
+    X(nvmlDeviceGetTemperature, 1) \
+    X(nvmlDeviceGetUtilizationRates, 1) \
+    X(nvmlDeviceGetPowerUsage, 1) \
+    X(nvmlDeviceGetEnforcedPowerLimit, 1) \
+    X(nvmlDeviceGetTotalEccErrors, 1) \
+    X(nvmlDeviceGetRemappedRows, 0)
+#define NVML_SYMBOL_NAME(name) #name
+#define NVML_SYMBOL(name) NVML_SYMBOL_NAME(name)
+#define NVML_POINTER(name, required) __typeof__(&name) name;
+
+static struct {
+    void *library;
+    NVML_FUNCTIONS(NVML_POINTER)
+} nvml;
 
 #define REFRESH_DURATION 1
+#define CONFIG_LINE_SIZE 1024
+#define OVERSAMPLE_MAX 32
+#define HISTORY_SIZE 256
+#define HISTORY_SERIES 2
+#define SPARK_MIN_WIDTH 8
+#define SPARK_MIN_TEMP 30
+#define TREND_SAMPLES 10
+#define TREND_THRESHOLD 2
+#define DEFAULT_COLUMNS 80
 #define BUFFER_SIZE 1024
+#define GPU_BUFFER_SIZE 256
+#define OUTPUT_STREAM_SIZE 8192
+#define TRACE_CAPACITY 262144
+#define RAW_MAGIC "GPUTRAW"
+#define RAW_VERSION 1
+#define RAW_NAME_SIZE 8
+#define RAW_BUS_ID_SIZE 16
+#define RAW_RECORD_HEADER_SIZE 12
+#define RAW_BUFFER_SIZE 65536
+#define DECODE_BATCH 4096
+#define SCAN_WINDOW 0x00040000
+#define SCAN_MAX_WINDOW 0x01000000
+#define SCAN_DURATION 120
+#define SCAN_INTERVAL_MS 250
+#define SCAN_PROGRESS_SWEEPS 40
+#define SCAN_BELOW 20
+#define SCAN_ABOVE 40
+#define SCAN_SHIFTS_7 26
+#define SCAN_SHIFTS_8 25
+#define SCAN_MAX_TRACKED 65536
+#define SCAN_MIN_SAMPLES 20
+#define SCAN_MIN_CORE_RANGE 10
+#define SCAN_MIN_R2 0.6
+#define SCAN_MAX_RESULTS 16
+#define STEP_DURATION 600
+#define STEP_INTERVAL_MS 100
+#define STEP_LAG_SAMPLES 10
+#define STEP_WINDOW_S 120
+#define STEP_EMA_SAMPLES 20
+#define STEP_MIN_W 25
+#define STEP_LIMIT_PERCENT 10
+#define STEP_MIN_SAMPLES 100
+#define STEP_PROGRESS_S 60
+#define HIST_SUB_BITS 3
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS 36
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
 
 #define HOTSPOT_REGISTER_OFFSET 0x0002046C
 #define VRAM_REGISTER_OFFSET 0x0000E2A8
 #define PG_SZ sysconf(_SC_PAGE_SIZE)
 #define MEM_PATH "/dev/mem"
+#define MEM_PATH_ENV "GPUTEMPS_MEM_PATH"
+#define PCI_DUMP_ENV "GPUTEMPS_PCI_DUMP"
+#define SYSFS_ROOT "/sys"
+#define SYSFS_ROOT_ENV "GPUTEMPS_SYSFS_ROOT"
+#define HWMON_DRIVER "amdgpu"
+#define HWMON_MAX_SENSORS 16
+#define BUS_ID_SIZE 16
+#define UUID_SIZE 96
+#define TOPOLOGY_INTERVAL 5
+#define ECO_SLACK_DIVISOR 8
+#define ECO_FLUSH_RECORDS 16
+#define ECO_SUSPENDED_INTERVAL_MS 10000
+#define QUEUE_RECORDS 16
+#define QUEUE_MAX_RECORDS 1024
+#define COMPRESS_BLOCK_SIZE 262144
+#define COMPRESS_INPUT_SIZE (2 * COMPRESS_BLOCK_SIZE)
+#define COMPRESS_FLUSH_INTERVAL 10
+#define BASELINE_MAGIC "GPUBASE"
+#define BASELINE_VERSION 1
+#define BASELINE_UTIL_BINS 10
+#define BASELINE_POWER_BINS 10
+#define BASELINE_BINS (BASELINE_UTIL_BINS * BASELINE_POWER_BINS)
+#define BASELINE_RECORD_SIZE (UUID_SIZE + BASELINE_BINS * FIELD_COUNT * 12)
+#define BASELINE_MIN_SAMPLES 30
+#define BASELINE_MIN_LIVE 10
+#define BASELINE_SETTLE 3
+#define BASELINE_SMOOTHING 16
+#define BASELINE_SAVE_INTERVAL 60
+#define BASELINE_REGRESSION 3
+#define BUSY_UTIL 50
+#define QUALITY_SLEW_SAMPLES 3
+#define QUALITY_STUCK_BUSY_MS 600000
+#define QUALITY_STUCK_MIN_MS 60000
+#define QUALITY_STUCK_CORE_RANGE 10
+#define QUALITY_JUNCTION_BELOW 5
+#define QUALITY_MAX_SPREAD 60
+#define QUALITY_BUSY_CACHE_MS 5000
+#define SAMPLE_MAX_GAP_MS 10000
+#define SAMPLE_MAX_GAP_INTERVALS 4
+#define ECC_MAGIC "GPUECC"
+#define ECC_VERSION 1
+#define ECC_BIN_WIDTH 5
+#define ECC_BINS 24
+#define ECC_RECORD_SIZE (UUID_SIZE + ECC_BINS * (1 + ECC_COUNTER_COUNT) * 8)
+#define ECC_INTERVAL 60
+#define ECC_SAVE_INTERVAL 60
+#define ECC_BUFFER_SIZE (256 + ECC_BINS * 16)
+#define PCIE_BUFFER_SIZE 256
+#define PCIE_AER_SIZE 1024
+#define STATM_PATH "/proc/self/statm"
+#define SYS_ENTER_ID_PATH "/sys/kernel/tracing/events/raw_syscalls/sys_enter/id"
+#define SYS_ENTER_ID_PATH_DEBUGFS "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id"
 
 #define SEPARATOR     "\xE2\x94\x82"
 #define CURSOR_HIDE   "\x1B[?25l"
@@ -28,16 +214,155 @@
 #define COLOR_YELLOW  "\x1B[33m"
 #define COLOR_RED     "\x1B[31m"
 
-const uint32_t GPU_TEMP_WARN = 70;
-const uint32_t GPU_TEMP_DANGER = 85;
-const uint32_t JUNCTION_TEMP_WARN = 80;
-const uint32_t JUNCTION_TEMP_DANGER = 95;
-const uint32_t VRAM_TEMP_WARN = 80;
-const uint32_t VRAM_TEMP_DANGER = 95;
-
 static volatile sig_atomic_t running = 1;
+static volatile sig_atomic_t dump_requested = 0;
+static volatile sig_atomic_t reload_requested = 0;
+static volatile sig_atomic_t resize_requested = 0;
+static volatile sig_atomic_t mark_requested = 0;
+
+/* Buffer of the output stream, which stdio would otherwise allocate on the
+ * first write. */
+static char output_stream_buffer[OUTPUT_STREAM_SIZE];
 static struct termios orig_termios;
 
+typedef enum {
+    REG_JUNCTION,
+    REG_VRAM,
+    REG_COUNT
+} RegisterId;
+
+/* A temperature register holds the value in °C as a bitfield of the given
+ * shift and width. `gputemps scan` prints its candidates in this form. */
+typedef struct {
+    const char *name;
+    uint32_t offset;
+    uint8_t shift;
+    uint8_t width;
+} RegisterField;
+
+typedef uint32_t u32x8 __attribute__((vector_size(32)));
+
+static const RegisterField REGISTERS[REG_COUNT] = {
+    {"junction", HOTSPOT_REGISTER_OFFSET, 8, 8},
+    {"vram", VRAM_REGISTER_OFFSET, 5, 7},
+};
+
+typedef enum {
+    FIELD_CORE,
+    FIELD_JUNCTION,
+    FIELD_VRAM,
+    FIELD_COUNT
+} Field;
+
+static const char *const FIELD_NAMES[FIELD_COUNT] = {"core", "junction", "vram"};
+static const char *const FIELD_HEADERS[FIELD_COUNT] = {"CORE", "JUNC", "VRAM"};
+
+/* Largest plausible change of a reading: a step between two samples, plus
+ * a rate in °C per second for the time in between. VRAM heats slowest. */
+static const uint8_t QUALITY_MAX_STEP[FIELD_COUNT] = {15, 20, 8};
+static const uint8_t QUALITY_MAX_SLEW[FIELD_COUNT] = {5, 5, 2};
+
+/* Quality flags of a reading, as bits. */
+typedef enum {
+    QUALITY_STUCK,
+    QUALITY_SLEW,
+    QUALITY_CORE,
+    QUALITY_COUNT
+} QualityFlag;
+
+static const char *const QUALITY_NAMES[QUALITY_COUNT] = {"stuck", "slew", "core"};
+
+/* hwmon temperature labels of the amdgpu driver, by field. */
+static const char *const HWMON_LABELS[FIELD_COUNT] = {"edge", "junction", "mem"};
+
+static const Field HISTORY_FIELDS[HISTORY_SERIES] = {FIELD_JUNCTION, FIELD_VRAM};
+static const char *const SPARK_LEVELS[] = {
+    "\xE2\x96\x81", "\xE2\x96\x82", "\xE2\x96\x83", "\xE2\x96\x84",
+    "\xE2\x96\x85", "\xE2\x96\x86", "\xE2\x96\x87", "\xE2\x96\x88"
+};
+#define SPARK_LEVEL_COUNT (sizeof(SPARK_LEVELS) / sizeof(SPARK_LEVELS[0]))
+
+/* How back-to-back loads of one register are reduced to a reading. */
+typedef enum {
+    FILTER_MEDIAN,
+    FILTER_TRIMMED
+} Filter;
+
+static const char *const FILTER_NAMES[] = {"median", "trimmed"};
+
+/* What a full output queue does with the next JSON record. */
+typedef enum {
+    POLICY_DROP_OLDEST,
+    POLICY_DROP_NEWEST,
+    POLICY_LATEST,
+    POLICY_BLOCK
+} Policy;
+
+static const char *const POLICY_NAMES[] = {"drop-oldest", "drop-newest", "latest", "block"};
+
+typedef enum {
+    COMPRESS_NONE,
+    COMPRESS_GZIP
+} Compression;
+
+static const char *const COMPRESSION_NAMES[] = {"none", "gzip"};
+
+/* Everything that `--config FILE` can set, and that SIGHUP reloads without
+ * touching NVML, libpci or the open devices. Empty paths mean no sink. */
+typedef struct {
+    unsigned int interval_ms;
+    uint32_t warn[FIELD_COUNT];
+    uint32_t danger[FIELD_COUNT];
+    unsigned int fields;
+    unsigned int oversample;
+    Filter filter;
+    unsigned int queue_records;
+    Policy policy;
+    Compression compress;
+    uint32_t regression;
+    unsigned int ecc_interval;
+    char output_path[PATH_MAX];
+    char raw_path[PATH_MAX];
+} Config;
+
+/* A config key given on the command line. These are applied again after
+ * every read of the config file, so the command line wins over it. */
+typedef struct {
+    const char *key;
+    const char *value;
+} Setting;
+
+#define SETTING_FLAGS 6
+
+static const Config DEFAULT_CONFIG = {
+    .interval_ms = REFRESH_DURATION * 1000,
+    .warn = {70, 80, 80},
+    .danger = {85, 95, 95},
+    .fields = (1u << FIELD_COUNT) - 1,
+    .oversample = 1,
+    .filter = FILTER_MEDIAN,
+    .queue_records = QUEUE_RECORDS,
+    .policy = POLICY_DROP_OLDEST,
+    .compress = COMPRESS_NONE,
+    .regression = BASELINE_REGRESSION,
+    .ecc_interval = ECC_INTERVAL,
+};
+
+typedef enum {
+    BACKEND_NVIDIA,
+    BACKEND_HWMON
+} Backend;
+
+/* How a row changed at the last topology check. */
+typedef enum {
+    CHANGE_NONE,
+    CHANGE_ADDED,
+    CHANGE_REMOVED,
+    CHANGE_MOVED
+} Change;
+
+static const char *const CHANGE_NAMES[] = {"none", "added", "removed", "moved"};
+
 typedef enum {
     FORMAT_TABLE,
     FORMAT_JSON
@@ -48,343 +373,4841 @@ typedef enum {
     MODE_ONCE
 } OutputMode;
 
+typedef enum {
+    STAGE_HANDLE,
+    STAGE_NVML_TEMP,
+    STAGE_PCI_INFO,
+    STAGE_PCI_MATCH,
+    STAGE_MAP,
+    STAGE_LOAD,
+    STAGE_UNMAP,
+    STAGE_DECODE,
+    STAGE_SERIALIZE,
+    STAGE_WRITE,
+    STAGE_SNAPSHOT,
+    STAGE_COUNT
+} Stage;
+
+static const char *const STAGE_NAMES[STAGE_COUNT] = {
+    "handle", "nvml_temp", "pci_info", "pci_match",
+    "map", "load", "unmap", "decode", "serialize", "write", "snapshot"
+};
+
+typedef enum {
+    ACCESS_HANDLE,
+    ACCESS_NVML_TEMP,
+    ACCESS_PCI_INFO,
+    ACCESS_MAP,
+    ACCESS_REGISTER,
+    ACCESS_COUNT,
+    ACCESS_NONE = ACCESS_COUNT
+} AccessKind;
+
+static const char *const ACCESS_NAMES[ACCESS_COUNT] = {
+    "nvml_handle", "nvml_temp", "nvml_pci_info", "register_map", "register_read"
+};
+
+static const AccessKind STAGE_ACCESS[STAGE_COUNT] = {
+    ACCESS_HANDLE, ACCESS_NVML_TEMP, ACCESS_PCI_INFO, ACCESS_NONE,
+    ACCESS_MAP, ACCESS_REGISTER, ACCESS_MAP, ACCESS_NONE,
+    ACCESS_NONE, ACCESS_NONE, ACCESS_NONE
+};
+
+/* Log-bucketed latency histogram with HIST_SUB_COUNT linear sub-buckets per
+ * power of two, i.e. a relative error of 1/HIST_SUB_COUNT, covering up to
+ * 2^HIST_MAX_BITS ns. Updates are relaxed atomics, so any thread may record
+ * while another one dumps. */
+typedef struct {
+    atomic_uint_fast64_t count;
+    atomic_uint_fast64_t sum_ns;
+    atomic_uint_fast64_t max_ns;
+    atomic_uint buckets[HIST_BUCKETS];
+} Histogram;
+
+typedef struct {
+    unsigned int iterations;
+    unsigned int iteration;
+    unsigned int rows;
+    uint32_t *samples;
+} Bench;
+
+typedef struct {
+    uint64_t start_ns;
+    uint32_t duration_ns;
+    uint32_t tid;
+    uint32_t row;
+    uint32_t stage;
+} TraceEvent;
+
+typedef struct {
+    const char *path;
+    TraceEvent *events;
+    size_t capacity;
+    atomic_size_t recorded;
+    uint64_t origin_ns;
+} Trace;
+
+/* An amdgpu hwmon node. The tempN_input files stay open and are read with
+ * pread() at offset 0, which makes sysfs format a fresh value. */
+typedef struct {
+    char bus_id[BUS_ID_SIZE];
+    int fds[FIELD_COUNT];
+    int seen;
+} HwmonDevice;
+
+/* sysfs files of a GPU's PCI function read with --pcie. */
+typedef enum {
+    PCIE_SPEED,
+    PCIE_WIDTH,
+    PCIE_MAX_SPEED,
+    PCIE_MAX_WIDTH,
+    PCIE_AER_CORRECTABLE,
+    PCIE_AER_NONFATAL,
+    PCIE_AER_FATAL,
+    PCIE_FILE_COUNT
+} PcieFile;
+
+static const char *const PCIE_FILES[PCIE_FILE_COUNT] = {
+    "current_link_speed", "current_link_width", "max_link_speed", "max_link_width",
+    "aer_dev_correctable", "aer_dev_nonfatal", "aer_dev_fatal"
+};
+
+/* PCIe link state of one GPU. The files stay open like the hwmon sensors;
+ * one the kernel does not provide, e.g. AER without CONFIG_PCIEAER, stays
+ * at -1 and reads as 0. Speeds are in tenths of GT/s. */
+typedef struct {
+    int fds[PCIE_FILE_COUNT];
+    int opened;
+    uint64_t values[PCIE_FILE_COUNT];
+    uint64_t best_speed;
+    uint64_t best_width;
+    int downtrained;
+    time_t since;
+    uint32_t temps[FIELD_COUNT];
+} PcieLink;
+
+/* Plausibility state of one sensor of one GPU. */
+typedef struct {
+    uint32_t last;
+    uint32_t accepted;
+    uint64_t accepted_ns;
+    uint64_t changed_ns;
+    uint64_t checked_ns;
+    uint32_t busy_ms;
+    uint32_t core_min;
+    uint32_t core_max;
+    uint8_t rejected;
+} SensorQuality;
+
+typedef struct {
+    SensorQuality sensors[FIELD_COUNT];
+    uint64_t busy_ns;
+    int busy;
+} GpuQuality;
+
+/* Last HISTORY_SIZE junction and VRAM readings of one GPU, for sparklines. */
+typedef struct {
+    uint8_t samples[HISTORY_SERIES][HISTORY_SIZE];
+    unsigned int head;
+    unsigned int count;
+} History;
+
+typedef struct {
+    int enabled;
+    int syscall_fd;
+    int statm_fd;
+    uint64_t last_syscalls;
+    long last_nvcsw;
+    long last_nivcsw;
+    struct timespec start_wall;
+    struct timespec start_cpu;
+} SelfStats;
+
+/* --eco state. Wakeups are the voluntary context switches of the whole
+ * process, so NVML's own threads count too. */
+typedef struct {
+    int enabled;
+    unsigned int suspended;
+    long start_nvcsw;
+    struct timespec start;
+} Eco;
+
+/* JSON records waiting for the output sink, back to back in a linear buffer
+ * with their lengths in a ring. The sink is written only when it can take
+ * more, so a slow reader costs records instead of sampling cadence. Pinned
+ * records, which announce GPU index changes, are never dropped. */
+typedef struct {
+    char *data;
+    size_t capacity;
+    size_t start; // first unwritten byte
+    size_t end;
+    size_t sent; // bytes of the first record already written
+    size_t *lengths;
+    unsigned char *pinned;
+    unsigned int max_records;
+    unsigned int first;
+    unsigned int count;
+    unsigned long long dropped;
+    int flushing;
+    int regular;
+    int fd;
+    int own_fd;
+    int socket;
+} OutputQueue;
+
+/* Background gzip compression of the output file. The sampler only copies
+ * records into input; at each flush point the thread swaps it with block,
+ * compresses that into one gzip member and writes the member with a single
+ * write(). The file is thus always a valid series of members, and a crash
+ * loses at most the block still in memory. */
+typedef struct {
+    int enabled;
+    int fd;
+    int stop;
+    int error;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t room;
+    char *input;
+    size_t input_size;
+    char *block;
+    unsigned char *member;
+    size_t member_capacity;
+    z_stream stream;
+    atomic_uint_fast64_t bytes_in;
+    atomic_uint_fast64_t bytes_out;
+    atomic_uint_fast64_t cpu_ns;
+} Compressor;
+
+/* Temperature sums of one GPU per load bin, i.e. per utilization and power
+ * decile, as persisted by --baseline FILE --learn. */
+typedef struct {
+    char uuid[UUID_SIZE];
+    uint32_t count[BASELINE_BINS][FIELD_COUNT];
+    uint64_t sum[BASELINE_BINS][FIELD_COUNT];
+} BaselineProfile;
+
+/* How far a GPU currently runs from its profile: a moving average of the
+ * deviation per load bin, updated with one bin per sample. */
+typedef struct {
+    int profile;
+    unsigned int power_limit_mw;
+    unsigned int last_bin;
+    unsigned int settled;
+    float deviation[BASELINE_BINS][FIELD_COUNT];
+    uint16_t live[BASELINE_BINS][FIELD_COUNT];
+} BaselineRow;
+
+/* NVML memory error counters sampled with --ecc. */
+typedef enum {
+    ECC_CORRECTED,
+    ECC_UNCORRECTED,
+    ECC_REMAPPED_CORRECTABLE,
+    ECC_REMAPPED_UNCORRECTABLE,
+    ECC_COUNTER_COUNT
+} EccCounter;
+
+static const char *const ECC_COUNTER_NAMES[ECC_COUNTER_COUNT] = {
+    "corrected", "uncorrected", "remapped_correctable", "remapped_uncorrectable"
+};
+
+/* Errors of one GPU per VRAM temperature bin of ECC_BIN_WIDTH °C, the last
+ * one open-ended, and the time spent in each bin, as persisted by --ecc. */
+typedef struct {
+    char uuid[UUID_SIZE];
+    uint64_t exposure_ms[ECC_BINS];
+    uint64_t errors[ECC_BINS][ECC_COUNTER_COUNT];
+} EccProfile;
+
+/* Counters of one GPU at its last check and the VRAM temperatures since. */
+typedef struct {
+    int profile;
+    int supported;
+    int reported;
+    int pending;
+    unsigned int known;
+    uint64_t last[ECC_COUNTER_COUNT];
+    uint64_t delta[ECC_COUNTER_COUNT];
+    struct timespec checked;
+    uint64_t sampled_ns;
+    uint32_t window[ECC_BINS];
+    uint32_t vram_min;
+    uint32_t vram_max;
+    uint64_t vram_sum;
+    uint32_t vram_samples;
+} EccRow;
+
+typedef struct {
+    const char *path;
+    EccProfile *profiles;
+    unsigned int profile_count;
+    EccRow *rows;
+    struct timespec saved;
+} Ecc;
+
+typedef struct {
+    const char *path;
+    int learn;
+    BaselineProfile *profiles;
+    unsigned int profile_count;
+    BaselineRow *rows;
+    struct timespec saved;
+} Baseline;
+
+typedef struct {
+    nvmlReturn_t result;
+    unsigned int device_count;
+    unsigned int *indices;
+    const char *gpu_selection;
+    int all_gpus;
+    unsigned int row_capacity;
+    char (*bus_ids)[BUS_ID_SIZE];
+    uint8_t *present;
+    uint8_t *changes;
+    unsigned int *previous_indices;
+    struct timespec topology_checked;
+    Backend backend;
+    const char *sysfs_root;
+    HwmonDevice *hwmon;
+    DIR *hwmon_dir;
+    unsigned int hwmon_count;
+    unsigned int hwmon_capacity;
+    int initialized;
+    struct pci_access *pacc;
+    const char *mem_path;
+    char *output_buffer;
+    size_t buffer_size;
+    size_t buffer_pos;
+    OutputMode output_mode;
+    OutputFormat output_format;
+    FILE *output;
+    OutputQueue queue;
+    Compressor compressor;
+    Baseline baseline;
+    Ecc ecc;
+    int pcie_enabled;
+    PcieLink *links;
+    GpuQuality *quality;
+    int topology_pending;
+    Bench *bench;
+    const char *trace_path;
+    Trace *trace;
+    Histogram *histograms;
+    int histograms_enabled;
+    FILE *raw;
+    unsigned int raw_rows;
+    const char *config_path;
+    Config base;
+    Config config;
+    Setting flags[SETTING_FLAGS];
+    unsigned int flag_count;
+    int sparklines;
+    History *history;
+    unsigned int spark_width;
+    int spark_redraw;
+    struct timespec stage_mark;
+    SelfStats self;
+    Eco eco;
+} Context;
+
+typedef struct {
+    nvmlDevice_t device;
+    nvmlPciInfo_t pci_info;
+    uint32_t gpu_temp;
+    uint32_t junction_temp;
+    uint32_t vram_temp;
+    uint32_t raw[REG_COUNT];
+    uint8_t spread[REG_COUNT];
+    uint8_t rejected[REG_COUNT];
+    int registers_read;
+    unsigned int utilization;
+    unsigned int power_mw;
+    int load_read;
+    int link_read;
+    int ecc_checked;
+    uint8_t quality[FIELD_COUNT];
+} GpuDevice;
+
+static uint64_t timespec_ns(const struct timespec *ts) {
+    return (uint64_t)ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+static uint32_t current_tid(void) {
+    static __thread uint32_t tid;
+    if (!tid) tid = (uint32_t)syscall(SYS_gettid);
+    return tid;
+}
+
+static char *trim(char *s) {
+    while (isspace((unsigned char)*s)) s++;
+    char *end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1])) end--;
+    *end = '\0';
+    return s;
+}
+
+static unsigned int hist_bucket(uint64_t ns) {
+    if (ns < HIST_SUB_COUNT) return (unsigned int)ns;
+    unsigned int msb = 63 - __builtin_clzll(ns);
+    if (msb >= HIST_MAX_BITS) return HIST_BUCKETS - 1;
+    return (msb - HIST_SUB_BITS + 1) * HIST_SUB_COUNT +
+        (unsigned int)((ns >> (msb - HIST_SUB_BITS)) & (HIST_SUB_COUNT - 1));
+}
+
+static uint64_t hist_bucket_limit(unsigned int bucket) {
+    if (bucket < HIST_SUB_COUNT) return bucket + 1;
+    unsigned int shift = bucket / HIST_SUB_COUNT - 1;
+    return (uint64_t)(HIST_SUB_COUNT + bucket % HIST_SUB_COUNT + 1) << shift;
+}
+
+static void hist_record(Histogram *hist, uint64_t ns) {
+    atomic_fetch_add_explicit(&hist->buckets[hist_bucket(ns)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->sum_ns, ns, memory_order_relaxed);
+
+    uint_fast64_t max = atomic_load_explicit(&hist->max_ns, memory_order_relaxed);
+    while (ns > max && !atomic_compare_exchange_weak_explicit(&hist->max_ns, &max, ns,
+           memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+static double hist_percentile_us(Histogram *hist, uint64_t count, double fraction) {
+    uint64_t rank = (uint64_t)(count * fraction);
+    uint64_t seen = 0;
+    for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+        seen += atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+        if (seen > rank) return hist_bucket_limit(i) / 1e3;
+    }
+    return hist_bucket_limit(HIST_BUCKETS - 1) / 1e3;
+}
+
+/* Dumps every non-empty histogram as a single JSON line on stderr, so it never
+ * interleaves with the snapshot stream. Bucket pairs are [limit_ns, count]. */
+static void dump_histograms(Context *ctx) {
+    if (!ctx->histograms) return;
+
+    int first = 1;
+    fprintf(stderr, "{\"timestamp\":%ld,\"histograms\":[", (long)time(NULL));
+    for (unsigned int gpu = 0; gpu < ctx->device_count; gpu++) {
+        for (int kind = 0; kind < ACCESS_COUNT; kind++) {
+            Histogram *hist = &ctx->histograms[(size_t)gpu * ACCESS_COUNT + kind];
+            uint64_t count = atomic_load_explicit(&hist->count, memory_order_relaxed);
+            if (count == 0) continue;
+
+            fprintf(stderr, "%s{\"gpu\":%u,\"access\":\"%s\",\"count\":%llu,"
+                "\"mean_us\":%.2f,\"max_us\":%.2f,\"p50_us\":%.2f,\"p90_us\":%.2f,"
+                "\"p99_us\":%.2f,\"p999_us\":%.2f,\"buckets\":[",
+                first ? "" : ",", ctx->indices[gpu], ACCESS_NAMES[kind], (unsigned long long)count,
+                atomic_load_explicit(&hist->sum_ns, memory_order_relaxed) / 1e3 / count,
+                atomic_load_explicit(&hist->max_ns, memory_order_relaxed) / 1e3,
+                hist_percentile_us(hist, count, 0.50), hist_percentile_us(hist, count, 0.90),
+                hist_percentile_us(hist, count, 0.99), hist_percentile_us(hist, count, 0.999));
+            first = 0;
+
+            int first_bucket = 1;
+            for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+                unsigned int n = atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+                if (n == 0) continue;
+                fprintf(stderr, "%s[%llu,%u]", first_bucket ? "" : ",",
+                    (unsigned long long)hist_bucket_limit(i), n);
+                first_bucket = 0;
+            }
+            fprintf(stderr, "]}");
+        }
+    }
+    fprintf(stderr, "]}\n");
+    fflush(stderr);
+}
+
+/* Stage timing feeds --bench, --trace and --histograms; all are off in normal
+ * runs, which then pay a single branch per stage. */
+static int stages_enabled(Context *ctx) {
+    return ctx->bench || ctx->trace || ctx->histograms;
+}
+
+static void stage_now(Context *ctx, struct timespec *ts) {
+    if (stages_enabled(ctx)) clock_gettime(CLOCK_MONOTONIC, ts);
+}
+
+static void stage_start(Context *ctx) {
+    stage_now(ctx, &ctx->stage_mark);
+}
+
+/* Records a stage spanning from start to now. The rows past the last GPU hold
+ * the per-snapshot stages. */
+static void stage_span(Context *ctx, unsigned int row, Stage stage,
+                       const struct timespec *start, struct timespec *end) {
+    uint64_t ns = timespec_ns(end) - timespec_ns(start);
+
+    if (ctx->bench) {
+        Bench *bench = ctx->bench;
+        uint32_t *slot = &bench->samples[((size_t)bench->iteration * bench->rows + row) *
+            STAGE_COUNT + stage];
+        *slot = (*slot + ns > UINT32_MAX) ? UINT32_MAX : (uint32_t)(*slot + ns);
+    }
+
+    if (ctx->histograms && row < ctx->device_count && STAGE_ACCESS[stage] != ACCESS_NONE)
+        hist_record(&ctx->histograms[(size_t)row * ACCESS_COUNT + STAGE_ACCESS[stage]], ns);
+
+    if (ctx->trace) {
+        Trace *trace = ctx->trace;
+        size_t slot = atomic_fetch_add_explicit(&trace->recorded, 1, memory_order_relaxed);
+        TraceEvent *event = &trace->events[slot % trace->capacity];
+        event->start_ns = timespec_ns(start);
+        event->duration_ns = ns > UINT32_MAX ? UINT32_MAX : (uint32_t)ns;
+        event->tid = current_tid();
+        event->row = row < ctx->device_count ? ctx->indices[row] : row;
+        event->stage = stage;
+    }
+}
+
+/* Charges the time elapsed since the previous mark to a stage. */
+static void stage_end(Context *ctx, unsigned int row, Stage stage) {
+    if (!stages_enabled(ctx)) return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    stage_span(ctx, row, stage, &ctx->stage_mark, &now);
+    ctx->stage_mark = now;
+}
+
+static void snapshot_end(Context *ctx, const struct timespec *start) {
+    if (!stages_enabled(ctx)) return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    stage_span(ctx, ctx->device_count, STAGE_SNAPSHOT, start, &now);
+}
+
+/* Root is needed for physical memory, whatever the path to it is called; a
+ * path that does not exist is reported when it is opened. */
+static int check_root_privileges(Context *ctx) {
+    struct stat st;
+    if (stat(ctx->mem_path, &st) < 0 || !S_ISCHR(st.st_mode) || st.st_rdev != makedev(1, 1))
+        return 0;
+    if (geteuid() != 0) {
+        fprintf(stderr, "This program requires root privileges\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int write_trace(Trace *trace) {
+    FILE *f = fopen(trace->path, "w");
+    if (!f) {
+        fprintf(stderr, "Failed to open %s: %s\n", trace->path, strerror(errno));
+        return -1;
+    }
+
+    size_t recorded = atomic_load_explicit(&trace->recorded, memory_order_relaxed);
+    size_t count = recorded < trace->capacity ? recorded : trace->capacity;
+    size_t first = recorded - count;
+    int pid = (int)getpid();
+
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped_events\":%zu},"
+        "\"traceEvents\":[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+        "\"args\":{\"name\":\"gputemps\"}}", first, pid);
+
+    for (size_t i = first; i < recorded; i++) {
+        TraceEvent *event = &trace->events[i % trace->capacity];
+        int per_gpu = event->stage != STAGE_WRITE && event->stage != STAGE_SNAPSHOT;
+        fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,"
+            "\"dur\":%.3f,\"pid\":%d,\"tid\":%u",
+            STAGE_NAMES[event->stage], per_gpu ? "gpu" : "output",
+            (event->start_ns - trace->origin_ns) / 1e3, event->duration_ns / 1e3,
+            pid, event->tid);
+        if (per_gpu) fprintf(f, ",\"args\":{\"gpu\":%u}", event->row);
+        fprintf(f, "}");
+    }
+    fprintf(f, "\n]}\n");
+
+    if (fclose(f) != 0) {
+        fprintf(stderr, "Failed to write %s: %s\n", trace->path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static int write_all(int fd, const void *data, size_t size) {
+    for (size_t done = 0; done < size;) {
+        ssize_t written = write(fd, (const char *)data + done, size - done);
+        if (written < 0 && errno == EINTR) continue;
+        if (written < 0) return -1;
+        done += (size_t)written;
+    }
+    return 0;
+}
+
+static int write_member(Compressor *compressor, size_t size) {
+    struct timespec cpu_start, cpu_end;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+    z_stream *stream = &compressor->stream;
+    deflateReset(stream);
+    stream->next_in = (Bytef *)compressor->block;
+    stream->avail_in = (uInt)size;
+    stream->next_out = compressor->member;
+    stream->avail_out = (uInt)compressor->member_capacity;
+    int result = deflate(stream, Z_FINISH);
+    size_t length = compressor->member_capacity - stream->avail_out;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+    atomic_fetch_add(&compressor->cpu_ns, timespec_ns(&cpu_end) - timespec_ns(&cpu_start));
+    if (result != Z_STREAM_END) {
+        errno = EIO;
+        return -1;
+    }
+
+    if (write_all(compressor->fd, compressor->member, length) < 0) return -1;
+    atomic_fetch_add(&compressor->bytes_in, size);
+    atomic_fetch_add(&compressor->bytes_out, length);
+    return 0;
+}
+
+/* Waits for the first record of a block, then until the block is full, the
+ * flush interval has passed since that record or the sink is closed. */
+static void *compress_thread(void *arg) {
+    Compressor *compressor = arg;
+    pthread_mutex_lock(&compressor->lock);
+    while (!compressor->error && (!compressor->stop || compressor->input_size > 0)) {
+        while (!compressor->stop && compressor->input_size == 0)
+            pthread_cond_wait(&compressor->wake, &compressor->lock);
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += COMPRESS_FLUSH_INTERVAL;
+        while (!compressor->stop && compressor->input_size < COMPRESS_BLOCK_SIZE &&
+               pthread_cond_timedwait(&compressor->wake, &compressor->lock, &deadline) != ETIMEDOUT) {
+        }
+        if (compressor->input_size == 0) continue;
+
+        char *block = compressor->input;
+        size_t size = compressor->input_size;
+        compressor->input = compressor->block;
+        compressor->input_size = 0;
+        compressor->block = block;
+        pthread_cond_signal(&compressor->room);
+        pthread_mutex_unlock(&compressor->lock);
+
+        int result = write_member(compressor, size);
+        pthread_mutex_lock(&compressor->lock);
+        if (result < 0) {
+            compressor->error = errno;
+            pthread_cond_signal(&compressor->room);
+        }
+    }
+    pthread_mutex_unlock(&compressor->lock);
+    return NULL;
+}
+
+/* Compresses the output file from now on. Everything, including zlib's own
+ * state and the thread, is allocated here rather than while sampling. */
+static int start_compressor(Context *ctx) {
+    Compressor *compressor = &ctx->compressor;
+    *compressor = (Compressor){.fd = fileno(ctx->output)};
+    if (deflateInit2(&compressor->stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+            Z_DEFAULT_STRATEGY) != Z_OK) {
+        fprintf(stderr, "Failed to initialize gzip compression\n");
+        return -1;
+    }
+    compressor->member_capacity = deflateBound(&compressor->stream, COMPRESS_INPUT_SIZE);
+    compressor->input = malloc(COMPRESS_INPUT_SIZE);
+    compressor->block = malloc(COMPRESS_INPUT_SIZE);
+    compressor->member = malloc(compressor->member_capacity);
+    if (!compressor->input || !compressor->block || !compressor->member) {
+        fprintf(stderr, "Failed to allocate compression buffers\n");
+        goto fail;
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&compressor->lock, NULL);
+    pthread_cond_init(&compressor->wake, &attr);
+    pthread_cond_init(&compressor->room, NULL);
+    pthread_condattr_destroy(&attr);
+
+    // Signals stay with the sampling thread, whose select() they interrupt.
+    sigset_t all, previous;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &previous);
+    int result = pthread_create(&compressor->thread, NULL, compress_thread, compressor);
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    if (result != 0) {
+        fprintf(stderr, "Failed to start the compression thread: %s\n", strerror(result));
+        pthread_mutex_destroy(&compressor->lock);
+        pthread_cond_destroy(&compressor->wake);
+        pthread_cond_destroy(&compressor->room);
+        goto fail;
+    }
+    compressor->enabled = 1;
+    return 0;
+
+fail:
+    deflateEnd(&compressor->stream);
+    free(compressor->input);
+    free(compressor->block);
+    free(compressor->member);
+    *compressor = (Compressor){0};
+    return -1;
+}
+
+static void report_compression(Context *ctx) {
+    Compressor *compressor = &ctx->compressor;
+    uint64_t bytes_in = atomic_load(&compressor->bytes_in);
+    uint64_t bytes_out = atomic_load(&compressor->bytes_out);
+    fprintf(stderr, "Compressed %s: %.1f KiB to %.1f KiB (%.1f:1) in %.3f s of CPU time\n",
+        ctx->config.output_path, bytes_in / 1024.0, bytes_out / 1024.0,
+        bytes_out ? (double)bytes_in / bytes_out : 0, atomic_load(&compressor->cpu_ns) / 1e9);
+}
+
+/* Writes out the block in progress and stops the thread. Records still in
+ * the output queue are not included; drain it first. */
+static int stop_compressor(Context *ctx) {
+    Compressor *compressor = &ctx->compressor;
+    if (!compressor->enabled) return 0;
+
+    pthread_mutex_lock(&compressor->lock);
+    compressor->stop = 1;
+    pthread_cond_signal(&compressor->wake);
+    pthread_mutex_unlock(&compressor->lock);
+    pthread_join(compressor->thread, NULL);
+
+    int error = compressor->error;
+    if (error) {
+        fprintf(stderr, "Failed to write %s: %s\n", ctx->config.output_path, strerror(error));
+    }
+    report_compression(ctx);
+    pthread_mutex_destroy(&compressor->lock);
+    pthread_cond_destroy(&compressor->wake);
+    pthread_cond_destroy(&compressor->room);
+    deflateEnd(&compressor->stream);
+    free(compressor->input);
+    free(compressor->block);
+    free(compressor->member);
+    *compressor = (Compressor){0};
+    return error ? -1 : 0;
+}
+
+static void cleanup_context(Context *ctx) {
+    if (!ctx) return;
+
+    if (ctx->raw) {
+        if (fclose(ctx->raw) != 0)
+            fprintf(stderr, "Failed to write %s: %s\n", ctx->config.raw_path, strerror(errno));
+        ctx->raw = NULL;
+    }
+
+    stop_compressor(ctx);
+    if (ctx->output && ctx->output != stdout) {
+        if (fclose(ctx->output) != 0)
+            fprintf(stderr, "Failed to write %s: %s\n", ctx->config.output_path, strerror(errno));
+        ctx->output = stdout;
+    }
+
+    if (ctx->histograms) {
+        dump_histograms(ctx);
+        free(ctx->histograms);
+        ctx->histograms = NULL;
+    }
+
+    if (ctx->trace) {
+        write_trace(ctx->trace);
+        free(ctx->trace->events);
+        free(ctx->trace);
+        ctx->trace = NULL;
+    }
+
+    if (ctx->initialized) {
+        nvml.nvmlShutdown();
+        ctx->initialized = 0;
+    }
+    if (nvml.library) {
+        dlclose(nvml.library);
+        memset(&nvml, 0, sizeof(nvml));
+    }
+
+    if (ctx->pacc) {
+        pci_cleanup(ctx->pacc);
+        ctx->pacc = NULL;
+    }
+
+    free(ctx->history);
+    ctx->history = NULL;
+    free(ctx->quality);
+    ctx->quality = NULL;
+
+    free(ctx->baseline.profiles);
+    free(ctx->baseline.rows);
+    ctx->baseline.profiles = NULL;
+    ctx->baseline.rows = NULL;
+    ctx->baseline.profile_count = 0;
+
+    free(ctx->ecc.profiles);
+    free(ctx->ecc.rows);
+    ctx->ecc.profiles = NULL;
+    ctx->ecc.rows = NULL;
+    ctx->ecc.profile_count = 0;
+
+    if (ctx->links) {
+        for (unsigned int row = 0; row < ctx->row_capacity; row++) {
+            for (int file = 0; file < PCIE_FILE_COUNT; file++) {
+                if (ctx->links[row].opened && ctx->links[row].fds[file] >= 0)
+                    close(ctx->links[row].fds[file]);
+            }
+        }
+        free(ctx->links);
+        ctx->links = NULL;
+    }
+
+    free(ctx->indices);
+    free(ctx->bus_ids);
+    free(ctx->present);
+    free(ctx->changes);
+    free(ctx->previous_indices);
+    ctx->indices = NULL;
+    ctx->bus_ids = NULL;
+    ctx->present = ctx->changes = NULL;
+    ctx->previous_indices = NULL;
+
+    if (ctx->hwmon) {
+        for (unsigned int i = 0; i < ctx->hwmon_count; i++) {
+            for (int field = 0; field < FIELD_COUNT; field++) {
+                if (ctx->hwmon[i].fds[field] >= 0) close(ctx->hwmon[i].fds[field]);
+            }
+        }
+        free(ctx->hwmon);
+        ctx->hwmon = NULL;
+    }
+    if (ctx->hwmon_dir) {
+        closedir(ctx->hwmon_dir);
+        ctx->hwmon_dir = NULL;
+    }
+
+    free(ctx->output_buffer);
+    ctx->output_buffer = NULL;
+    ctx->buffer_size = 0;
+
+    if (ctx->queue.own_fd) close(ctx->queue.fd);
+    free(ctx->queue.data);
+    free(ctx->queue.lengths);
+    free(ctx->queue.pinned);
+    ctx->queue = (OutputQueue){0};
+
+    if (ctx->self.enabled) {
+        if (ctx->self.syscall_fd >= 0) close(ctx->self.syscall_fd);
+        if (ctx->self.statm_fd >= 0) close(ctx->self.statm_fd);
+        ctx->self.syscall_fd = ctx->self.statm_fd = -1;
+    }
+}
+
+static void signal_handler(int signum) {
+    running = 0;
+}
+
+static void dump_signal_handler(int signum) {
+    dump_requested = 1;
+}
+
+static void reload_signal_handler(int signum) {
+    reload_requested = 1;
+}
+
+static void resize_signal_handler(int signum) {
+    resize_requested = 1;
+}
+
+static void mark_signal_handler(int signum) {
+    mark_requested = 1;
+}
+
+static void restore_cursor(void) {
+    printf(CURSOR_SHOW);
+    fflush(stdout);
+}
+
+static void reset_terminal(void) {
+    tcsetattr(STDIN_FILENO, TCSANOW, &orig_termios);
+}
+
+static int setup_terminal(void) {
+    struct termios new_termios;
+
+    if (tcgetattr(STDIN_FILENO, &orig_termios) < 0) return -1;
+    atexit(reset_terminal);
+    new_termios = orig_termios;
+    new_termios.c_lflag &= ~(ICANON | ECHO);
+    new_termios.c_cc[VMIN] = 0;
+    new_termios.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSANOW, &new_termios) < 0) return -1;
+    return 0;
+}
+
+static void buffer_append(Context *ctx, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int remaining = ctx->buffer_size - ctx->buffer_pos;
+    int written = vsnprintf(ctx->output_buffer + ctx->buffer_pos, remaining, format, args);
+    if (written > 0 && written < remaining) ctx->buffer_pos += written;
+    va_end(args);
+}
+
+static const char* get_temp_color(uint32_t temp, uint32_t warn, uint32_t danger) {
+    if (temp >= danger) return COLOR_RED;
+    if (temp >= warn) return COLOR_YELLOW;
+    return COLOR_GREEN;
+}
+
+static uint32_t field_value(const GpuDevice *gpu, Field field) {
+    switch (field) {
+    case FIELD_CORE: return gpu->gpu_temp;
+    case FIELD_JUNCTION: return gpu->junction_temp;
+    default: return gpu->vram_temp;
+    }
+}
+
+static void print_gpu_info(Context *ctx, unsigned int row, GpuDevice *gpu) {
+    const Config *config = &ctx->config;
+    buffer_append(ctx, "%u ", ctx->indices[row]);
+    for (int field = 0; field < FIELD_COUNT; field++) {
+        if (!(config->fields & (1u << field))) continue;
+        uint32_t temp = field_value(gpu, field);
+        // A reading that failed a plausibility check gets a question mark.
+        buffer_append(ctx, "%s %s%3u°C%s%s ", SEPARATOR,
+            get_temp_color(temp, config->warn[field], config->danger[field]),
+            temp, COLOR_RESET, gpu->quality[field] ? "?" : " ");
+    }
+    buffer_append(ctx, "%s", SEPARATOR);
+}
+
+/* A lost or suspended GPU keeps its row, with an 8-column placeholder in
+ * every cell, until it can be sampled again. */
+static void print_placeholder_row(Context *ctx, unsigned int row, const char *cell) {
+    buffer_append(ctx, "%u ", ctx->indices[row]);
+    for (int field = 0; field < FIELD_COUNT; field++) {
+        if (ctx->config.fields & (1u << field)) buffer_append(ctx, "%s%s", SEPARATOR, cell);
+    }
+    buffer_append(ctx, "%s", SEPARATOR);
+}
+
+static uint8_t history_at(const History *history, int series, unsigned int age) {
+    return history->samples[series][(history->head + HISTORY_SIZE - 1 - age) % HISTORY_SIZE];
+}
+
+static void history_push(History *history, const GpuDevice *gpu) {
+    for (int series = 0; series < HISTORY_SERIES; series++)
+        history->samples[series][history->head] = (uint8_t)field_value(gpu, HISTORY_FIELDS[series]);
+    history->head = (history->head + 1) % HISTORY_SIZE;
+    if (history->count < HISTORY_SIZE) history->count++;
+}
+
+static const char *trend_arrow(const History *history, int series) {
+    if (history->count < 2) return " ";
+    unsigned int age = history->count > TREND_SAMPLES ? TREND_SAMPLES : history->count - 1;
+    int delta = (int)history_at(history, series, 0) - (int)history_at(history, series, age);
+    if (delta >= TREND_THRESHOLD) return "\xE2\x86\x91";
+    if (delta <= -TREND_THRESHOLD) return "\xE2\x86\x93";
+    return "\xE2\x86\x92";
+}
+
+/* The scale is fixed from SPARK_MIN_TEMP to the danger threshold, so old
+ * columns never need to be redrawn. */
+static const char *spark_level(const Config *config, Field field, uint32_t temp) {
+    uint32_t top = config->danger[field];
+    if (temp <= SPARK_MIN_TEMP || top <= SPARK_MIN_TEMP) return SPARK_LEVELS[0];
+    if (temp >= top) return SPARK_LEVELS[SPARK_LEVEL_COUNT - 1];
+    return SPARK_LEVELS[(temp - SPARK_MIN_TEMP) * SPARK_LEVEL_COUNT / (top - SPARK_MIN_TEMP + 1)];
+}
+
+static unsigned int decimal_digits(unsigned int value) {
+    unsigned int digits = 1;
+    while (value >= 10) {
+        value /= 10;
+        digits++;
+    }
+    return digits;
+}
+
+/* Display width of a table row up to and including its last separator. */
+static unsigned int row_prefix_width(Context *ctx, unsigned int row) {
+    return decimal_digits(ctx->indices[row]) + 2 + 9 * __builtin_popcount(ctx->config.fields);
+}
+
+/* Fits one sparkline per series next to the widest row. A series takes its
+ * width plus 5 columns for the padding, the trend arrow and a separator. */
+static void update_spark_width(Context *ctx) {
+    struct winsize ws;
+    unsigned int columns = DEFAULT_COLUMNS;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0) columns = ws.ws_col;
+
+    unsigned int widest = 0;
+    for (unsigned int row = 0; row < ctx->device_count; row++) {
+        if (row_prefix_width(ctx, row) > widest) widest = row_prefix_width(ctx, row);
+    }
+    unsigned int used = widest + HISTORY_SERIES * 5;
+    unsigned int width = columns > used ? (columns - used) / HISTORY_SERIES : 0;
+    if (width > HISTORY_SIZE) width = HISTORY_SIZE;
+    ctx->spark_width = width >= SPARK_MIN_WIDTH ? width : 0;
+    ctx->spark_redraw = 1;
+}
+
+static void print_spark_header(Context *ctx) {
+    for (int series = 0; series < HISTORY_SERIES; series++) {
+        buffer_append(ctx, " %-*s %s", (int)ctx->spark_width + 2,
+            FIELD_HEADERS[HISTORY_FIELDS[series]], SEPARATOR);
+    }
+}
+
+static void print_sparkline(Context *ctx, const History *history, int series) {
+    const Config *config = &ctx->config;
+    Field field = HISTORY_FIELDS[series];
+    const char *color = NULL;
+
+    buffer_append(ctx, " ");
+    for (unsigned int age = ctx->spark_width; age-- > 0;) {
+        if (age >= history->count) {
+            buffer_append(ctx, " ");
+            continue;
+        }
+        uint32_t temp = history_at(history, series, age);
+        const char *next = get_temp_color(temp, config->warn[field], config->danger[field]);
+        if (next != color) buffer_append(ctx, "%s", next);
+        color = next;
+        buffer_append(ctx, "%s", spark_level(config, field, temp));
+    }
+    buffer_append(ctx, "%s %s %s", COLOR_RESET, trend_arrow(history, series), SEPARATOR);
+}
+
+/* Appends the sparklines of one row. Between full redraws every sparkline
+ * shifts left by one cell (DCH at its first column, ICH at its last, which
+ * leaves the rest of the line in place) and only the new cell and the trend
+ * arrow are written. */
+static void print_spark_row(Context *ctx, unsigned int row) {
+    const Config *config = &ctx->config;
+    const History *history = &ctx->history[row];
+    unsigned int column = row_prefix_width(ctx, row) + 2;
+
+    for (int series = 0; series < HISTORY_SERIES; series++) {
+        if (ctx->spark_redraw) {
+            print_sparkline(ctx, history, series);
+            continue;
+        }
+        Field field = HISTORY_FIELDS[series];
+        uint32_t temp = history_at(history, series, 0);
+        buffer_append(ctx, "\033[%uG\033[P\033[%uG\033[@%s%s%s %s",
+            column, column + ctx->spark_width - 1,
+            get_temp_color(temp, config->warn[field], config->danger[field]),
+            spark_level(config, field, temp), COLOR_RESET, trend_arrow(history, series));
+        column += ctx->spark_width + 5;
+    }
+}
+
+static int init_history(Context *ctx) {
+    if (!ctx->sparklines) return 0;
+
+    ctx->history = calloc(ctx->device_count, sizeof(*ctx->history));
+    if (!ctx->history) {
+        fprintf(stderr, "Failed to allocate history buffers\n");
+        return -1;
+    }
+    update_spark_width(ctx);
+    signal(SIGWINCH, resize_signal_handler);
+    return 0;
+}
+
+static int read_sysfs_line(int dir_fd, const char *name, char *buf, size_t size) {
+    int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    ssize_t n = read(fd, buf, size - 1);
+    close(fd);
+    if (n < 0) return -1;
+    buf[n] = '\0';
+    trim(buf);
+    return 0;
+}
+
+/* Returns 1 and the PCI bus ID if the hwmon node belongs to an amdgpu. */
+static int read_hwmon_bus_id(int dir_fd, char *bus_id) {
+    char value[64];
+    if (read_sysfs_line(dir_fd, "name", value, sizeof(value)) < 0 ||
+        strcmp(value, HWMON_DRIVER) != 0)
+        return 0;
+
+    // hwmonN/device links to the PCI device, named after its bus ID.
+    char target[PATH_MAX];
+    ssize_t n = readlinkat(dir_fd, "device", target, sizeof(target) - 1);
+    target[n > 0 ? n : 0] = '\0';
+    const char *name = strrchr(target, '/') ? strrchr(target, '/') + 1 : target;
+    size_t len = strnlen(name, BUS_ID_SIZE - 1);
+    memcpy(bus_id, name, len);
+    bus_id[len] = '\0';
+    return 1;
+}
+
+static void close_hwmon_device(HwmonDevice *device) {
+    for (int field = 0; field < FIELD_COUNT; field++) {
+        if (device->fds[field] >= 0) close(device->fds[field]);
+        device->fds[field] = -1;
+    }
+}
+
+/* Opens the tempN_input of every labelled sensor of one hwmon node. Returns 1
+ * if the node is an amdgpu with at least an edge sensor, 0 to skip it. */
+static int open_hwmon_device(int dir_fd, HwmonDevice *device) {
+    char name[32], value[64];
+
+    if (!read_hwmon_bus_id(dir_fd, device->bus_id)) return 0;
+
+    for (int field = 0; field < FIELD_COUNT; field++) device->fds[field] = -1;
+    for (int sensor = 1; sensor <= HWMON_MAX_SENSORS; sensor++) {
+        snprintf(name, sizeof(name), "temp%d_label", sensor);
+        if (read_sysfs_line(dir_fd, name, value, sizeof(value)) < 0) continue;
+        for (int field = 0; field < FIELD_COUNT; field++) {
+            if (strcmp(value, HWMON_LABELS[field]) != 0 || device->fds[field] >= 0) continue;
+            snprintf(name, sizeof(name), "temp%d_input", sensor);
+            device->fds[field] = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+        }
+    }
+    if (device->fds[FIELD_CORE] < 0) {
+        close_hwmon_device(device);
+        return 0;
+    }
+    return 1;
+}
+
+/* Makes room for one more hwmon device. */
+static int grow_hwmon(Context *ctx) {
+    if (ctx->hwmon_count < ctx->hwmon_capacity) return 0;
+    unsigned int capacity = ctx->hwmon_capacity ? ctx->hwmon_capacity * 2 : 8;
+    HwmonDevice *devices = realloc(ctx->hwmon, capacity * sizeof(*devices));
+    if (!devices) {
+        fprintf(stderr, "Failed to allocate hwmon devices\n");
+        return -1;
+    }
+    ctx->hwmon = devices;
+    ctx->hwmon_capacity = capacity;
+    return 0;
+}
+
+static int compare_hwmon(const void *a, const void *b) {
+    return strcmp(((const HwmonDevice *)a)->bus_id, ((const HwmonDevice *)b)->bus_id);
+}
+
+/* Finds the amdgpu hwmon nodes under SYSFS_ROOT (or $GPUTEMPS_SYSFS_ROOT) and
+ * numbers them in PCI bus order. */
+static int init_hwmon(Context *ctx) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/class/hwmon", ctx->sysfs_root);
+    DIR *dir = opendir(path);
+    if (!dir) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        if (strncmp(entry->d_name, "hwmon", 5) != 0) continue;
+        if (grow_hwmon(ctx) < 0) {
+            closedir(dir);
+            return -1;
+        }
+        int hwmon_fd = openat(dirfd(dir), entry->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (hwmon_fd < 0) continue;
+        ctx->hwmon_count += open_hwmon_device(hwmon_fd, &ctx->hwmon[ctx->hwmon_count]);
+        close(hwmon_fd);
+    }
+    // Kept open and rewound by topology checks, which would otherwise
+    // allocate a new DIR every time.
+    ctx->hwmon_dir = dir;
+
+    if (ctx->hwmon_count == 0) {
+        fprintf(stderr, "No %s hwmon devices found in %s/class/hwmon\n",
+            HWMON_DRIVER, ctx->sysfs_root);
+        return -1;
+    }
+    qsort(ctx->hwmon, ctx->hwmon_count, sizeof(*ctx->hwmon), compare_hwmon);
+    ctx->device_count = ctx->hwmon_count;
+    return 0;
+}
+
+static int init_pci(Context *ctx) {
+    ctx->pacc = pci_alloc();
+    if (!ctx->pacc) {
+        fprintf(stderr, "Failed to allocate PCI structure\n");
+        return -1;
+    }
+    const char *dump = getenv(PCI_DUMP_ENV);
+    if (dump && *dump) {
+        ctx->pacc->method = PCI_ACCESS_DUMP;
+        pci_set_param(ctx->pacc, "dump.name", (char *)dump);
+    }
+    pci_init(ctx->pacc);
+    pci_scan_bus(ctx->pacc);
+    return 0;
+}
+
+static uint64_t nvml_probe_start(void) {
+    if (!PROBE_ENABLED(nvml_call)) return 0;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return timespec_ns(&now);
+}
+
+static void nvml_probe_end(const char *function, unsigned int index,
+                           nvmlReturn_t result, uint64_t start_ns) {
+    if (!PROBE_ENABLED(nvml_call)) return;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    PROBE4(nvml_call, function, index, (int)result,
+        start_ns ? timespec_ns(&now) - start_ns : 0);
+}
+
+static int load_nvml(void) {
+    if (nvml.library) return 0;
+    nvml.library = dlopen(NVML_LIBRARY, RTLD_NOW | RTLD_LOCAL);
+    if (!nvml.library) {
+        fprintf(stderr, "Failed to load NVML: %s\n", dlerror());
+        return -1;
+    }
+#define NVML_RESOLVE(name, required) \
+    *(void **)&nvml.name = dlsym(nvml.library, NVML_SYMBOL(name)); \
+    if (!nvml.name && required) { \
+        fprintf(stderr, "Failed to load NVML: %s not found\n", NVML_SYMBOL(name)); \
+        dlclose(nvml.library); \
+        memset(&nvml, 0, sizeof(nvml)); \
+        return -1; \
+    }
+    NVML_FUNCTIONS(NVML_RESOLVE)
+#undef NVML_RESOLVE
+    return 0;
+}
+
+static int init_nvml(Context *ctx) {
+    if (load_nvml() < 0) return -1;
+    uint64_t start_ns = nvml_probe_start();
+    ctx->result = nvml.nvmlInit();
+    nvml_probe_end("nvmlInit", UINT32_MAX, ctx->result, start_ns);
+    if (NVML_SUCCESS != ctx->result) {
+        fprintf(stderr, "Failed to initialize NVML: %s\n",
+          nvml.nvmlErrorString(ctx->result));
+        return -1;
+    }
+    ctx->initialized = 1;
+    return 0;
+}
+
+static int get_device_count(Context *ctx) {
+    uint64_t start_ns = nvml_probe_start();
+    ctx->result = nvml.nvmlDeviceGetCount(&ctx->device_count);
+    nvml_probe_end("nvmlDeviceGetCount", UINT32_MAX, ctx->result, start_ns);
+    if (NVML_SUCCESS != ctx->result) {
+        fprintf(stderr, "Failed to get device count: %s\n",
+          nvml.nvmlErrorString(ctx->result));
+        return -1;
+    }
+    if (ctx->device_count == 0) {
+        fprintf(stderr, "No NVIDIA GPUs found\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int resolve_hwmon_gpu(Context *ctx, const char *entry, unsigned int *index) {
+    // Without a domain, match "bus:device.function" against the rest.
+    size_t skip = strchr(entry, ':') == strrchr(entry, ':') ? 5 : 0;
+    for (unsigned int i = 0; i < ctx->hwmon_count; i++) {
+        if (strlen(ctx->hwmon[i].bus_id) >= skip &&
+            strcasecmp(ctx->hwmon[i].bus_id + skip, entry) == 0) {
+            *index = i;
+            return 0;
+        }
+    }
+    fprintf(stderr, "No hwmon device with bus ID %s\n", entry);
+    return -1;
+}
+
+/* Resolves one --gpus entry to a GPU index. UUIDs and bus IDs are looked up
+ * by NVML directly, so no other GPU gets a handle. */
+static int resolve_gpu(Context *ctx, const char *entry, unsigned int total, unsigned int *index) {
+    nvmlDevice_t device;
+    const char *function;
+
+    if (entry[strspn(entry, "0123456789")] == '\0') {
+        unsigned long value = strtoul(entry, NULL, 10);
+        if (value >= total) {
+            fprintf(stderr, "Invalid GPU index %s, %u GPUs found\n", entry, total);
+            return -1;
+        }
+        *index = (unsigned int)value;
+        return 0;
+    }
+    if (ctx->backend == BACKEND_HWMON) {
+        if (strchr(entry, ':')) return resolve_hwmon_gpu(ctx, entry, index);
+        fprintf(stderr, "Invalid GPU %s, expected an index or a PCI bus ID\n", entry);
+        return -1;
+    }
+
+    uint64_t start_ns = nvml_probe_start();
+    if (strncmp(entry, "GPU-", 4) == 0) {
+        function = "nvmlDeviceGetHandleByUUID";
+        ctx->result = nvml.nvmlDeviceGetHandleByUUID(entry, &device);
+    } else if (strchr(entry, ':')) {
+        function = "nvmlDeviceGetHandleByPciBusId";
+        ctx->result = nvml.nvmlDeviceGetHandleByPciBusId(entry, &device);
+    } else {
+        fprintf(stderr, "Invalid GPU %s, expected an index, a GPU- UUID or a PCI bus ID\n", entry);
+        return -1;
+    }
+    nvml_probe_end(function, UINT32_MAX, ctx->result, start_ns);
+    if (NVML_SUCCESS != ctx->result) {
+        fprintf(stderr, "Failed to find GPU %s: %s\n", entry, nvml.nvmlErrorString(ctx->result));
+        return -1;
+    }
+
+    start_ns = nvml_probe_start();
+    ctx->result = nvml.nvmlDeviceGetIndex(device, index);
+    nvml_probe_end("nvmlDeviceGetIndex", UINT32_MAX, ctx->result, start_ns);
+    if (NVML_SUCCESS != ctx->result) {
+        fprintf(stderr, "Failed to get index of GPU %s: %s\n", entry, nvml.nvmlErrorString(ctx->result));
+        return -1;
+    }
+    return 0;
+}
+
+/* Maps table and JSON rows to NVML indices. Without --gpus every GPU is
+ * sampled; "--gpus cuda" takes the list from CUDA_VISIBLE_DEVICES. */
+static int init_gpu_selection(Context *ctx) {
+    unsigned int total = ctx->device_count;
+    ctx->indices = malloc(total * sizeof(*ctx->indices));
+    if (!ctx->indices) {
+        fprintf(stderr, "Failed to allocate GPU selection\n");
+        return -1;
+    }
+
+    const char *selection = ctx->gpu_selection;
+    if (selection && strcmp(selection, "cuda") == 0) selection = getenv("CUDA_VISIBLE_DEVICES");
+    if (!selection) {
+        for (unsigned int i = 0; i < total; i++) ctx->indices[i] = i;
+        ctx->all_gpus = 1;
+        return 0;
+    }
+
+    char *list = strdup(selection);
+    if (!list) {
+        fprintf(stderr, "Failed to allocate GPU selection\n");
+        return -1;
+    }
+
+    unsigned int count = 0;
+    int result = 0;
+    char *save;
+    for (char *entry = strtok_r(list, ",", &save); entry && result == 0;
+         entry = strtok_r(NULL, ",", &save)) {
+        entry = trim(entry);
+        if (!*entry) continue;
+
+        unsigned int index;
+        result = resolve_gpu(ctx, entry, total, &index);
+        if (result < 0) break;
+
+        unsigned int i = 0;
+        while (i < count && ctx->indices[i] != index) i++;
+        if (i == count && count < total) ctx->indices[count++] = index;
+    }
+    free(list);
+
+    if (result == 0 && count == 0) {
+        fprintf(stderr, "No GPUs selected\n");
+        result = -1;
+    }
+    ctx->device_count = count;
+    return result;
+}
+
+static int init_output_buffer(Context *ctx) {
+    size_t gpu_buffer_size = GPU_BUFFER_SIZE;
+    // A full sparkline redraw can need a color change before every cell.
+    if (ctx->sparklines) gpu_buffer_size += HISTORY_SERIES * (HISTORY_SIZE * 8 + 64);
+    if (ctx->pcie_enabled) gpu_buffer_size += PCIE_BUFFER_SIZE;
+    if (ctx->ecc.path) gpu_buffer_size += ECC_BUFFER_SIZE;
+    size_t size = BUFFER_SIZE + (size_t)ctx->device_count * gpu_buffer_size;
+    // Also grows the buffer when a GPU is added, possibly mid-snapshot.
+    char *buffer = realloc(ctx->output_buffer, size);
+    if (!buffer) {
+        fprintf(stderr, "Failed to allocate output buffer\n");
+        return -1;
+    }
+    ctx->output_buffer = buffer;
+    ctx->buffer_size = size;
+    return 0;
+}
+
+/* Trace events go to a ring preallocated at startup and are only formatted
+ * on exit, so tracing does no I/O or allocation while sampling. */
+static int init_trace(Context *ctx) {
+    if (!ctx->trace_path) return 0;
+
+    Trace *trace = calloc(1, sizeof(*trace));
+    if (trace) trace->events = calloc(TRACE_CAPACITY, sizeof(TraceEvent));
+    if (!trace || !trace->events) {
+        fprintf(stderr, "Failed to allocate trace buffer\n");
+        free(trace);
+        return -1;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    trace->path = ctx->trace_path;
+    trace->capacity = TRACE_CAPACITY;
+    trace->origin_ns = timespec_ns(&now);
+    ctx->trace = trace;
+    return 0;
+}
+
+static int init_histograms(Context *ctx) {
+    if (!ctx->histograms_enabled) return 0;
+
+    ctx->histograms = calloc((size_t)ctx->device_count * ACCESS_COUNT, sizeof(Histogram));
+    if (!ctx->histograms) {
+        fprintf(stderr, "Failed to allocate latency histograms\n");
+        return -1;
+    }
+    signal(SIGUSR1, dump_signal_handler);
+    return 0;
+}
+
+static int open_syscall_counter(void) {
+    char buf[32] = {0};
+    int fd = open(SYS_ENTER_ID_PATH, O_RDONLY);
+    if (fd < 0) fd = open(SYS_ENTER_ID_PATH_DEBUGFS, O_RDONLY);
+    if (fd < 0) return -1;
+    ssize_t len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0) return -1;
+
+    struct perf_event_attr attr = {0};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_TRACEPOINT;
+    attr.config = strtoull(buf, NULL, 10);
+    attr.inherit = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+static uint64_t read_syscall_count(Context *ctx) {
+    uint64_t count = 0;
+    if (ctx->self.syscall_fd < 0 ||
+        read(ctx->self.syscall_fd, &count, sizeof(count)) != sizeof(count))
+        return 0;
+    return count;
+}
+
+static long read_rss_kib(Context *ctx) {
+    char buf[128];
+    long pages, resident;
+    ssize_t len = pread(ctx->self.statm_fd, buf, sizeof(buf) - 1, 0);
+    if (len <= 0) return -1;
+    buf[len] = '\0';
+    if (sscanf(buf, "%ld %ld", &pages, &resident) != 2) return -1;
+    return resident * (PG_SZ / 1024);
+}
+
+/* Self-metrics are optional: a missing syscall tracepoint (no tracefs, or
+ * perf_event_paranoid too strict) only drops the syscall count. */
+static int init_self_stats(Context *ctx) {
+    if (!ctx->self.enabled) return 0;
+
+    ctx->self.statm_fd = open(STATM_PATH, O_RDONLY | O_CLOEXEC);
+    if (ctx->self.statm_fd < 0) {
+        fprintf(stderr, "Failed to open %s: %s\n", STATM_PATH, strerror(errno));
+        return -1;
+    }
+    ctx->self.syscall_fd = open_syscall_counter();
+    ctx->self.last_syscalls = read_syscall_count(ctx);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    ctx->self.last_nvcsw = usage.ru_nvcsw;
+    ctx->self.last_nivcsw = usage.ru_nivcsw;
+    return 0;
+}
+
+static void self_stats_begin(Context *ctx) {
+    if (!ctx->self.enabled) return;
+    clock_gettime(CLOCK_MONOTONIC, &ctx->self.start_wall);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ctx->self.start_cpu);
+}
+
+/* Latency and CPU time cover this snapshot up to its serialization; syscalls
+ * and context switches are counted since the previous record. */
+static void append_self_stats(Context *ctx) {
+    if (!ctx->self.enabled) return;
+
+    struct timespec wall, cpu;
+    struct rusage usage;
+    clock_gettime(CLOCK_MONOTONIC, &wall);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+    getrusage(RUSAGE_SELF, &usage);
+
+    long latency_us = (wall.tv_sec - ctx->self.start_wall.tv_sec) * 1000000L +
+        (wall.tv_nsec - ctx->self.start_wall.tv_nsec) / 1000;
+    long cpu_us = (cpu.tv_sec - ctx->self.start_cpu.tv_sec) * 1000000L +
+        (cpu.tv_nsec - ctx->self.start_cpu.tv_nsec) / 1000;
+
+    buffer_append(ctx, ",\"self\":{\"latency_us\":%ld,\"cpu_us\":%ld", latency_us, cpu_us);
+    if (ctx->self.syscall_fd >= 0) {
+        uint64_t syscalls = read_syscall_count(ctx);
+        buffer_append(ctx, ",\"syscalls\":%llu",
+            (unsigned long long)(syscalls - ctx->self.last_syscalls));
+        ctx->self.last_syscalls = syscalls;
+    }
+    buffer_append(ctx, ",\"vol_ctxsw\":%ld,\"invol_ctxsw\":%ld,\"rss_kib\":%ld",
+        usage.ru_nvcsw - ctx->self.last_nvcsw,
+        usage.ru_nivcsw - ctx->self.last_nivcsw,
+        read_rss_kib(ctx));
+    if (ctx->compressor.enabled) {
+        uint64_t bytes_out = atomic_load(&ctx->compressor.bytes_out);
+        buffer_append(ctx, ",\"gzip_ratio\":%.2f,\"gzip_cpu_us\":%llu",
+            bytes_out ? (double)atomic_load(&ctx->compressor.bytes_in) / bytes_out : 0,
+            (unsigned long long)(atomic_load(&ctx->compressor.cpu_ns) / 1000));
+    }
+    buffer_append(ctx, "}");
+    ctx->self.last_nvcsw = usage.ru_nvcsw;
+    ctx->self.last_nivcsw = usage.ru_nivcsw;
+}
+
+static void set_timer_slack(Context *ctx) {
+    prctl(PR_SET_TIMERSLACK, (unsigned long)ctx->config.interval_ms * 1000000UL / ECO_SLACK_DIVISOR);
+}
+
+/* --eco lets the kernel coalesce our timer with other wakeups, within an
+ * eighth of the interval, and batches JSON records into fewer writes. */
+static int init_eco(Context *ctx) {
+    if (!ctx->eco.enabled) return 0;
+
+    set_timer_slack(ctx);
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    ctx->eco.start_nvcsw = usage.ru_nvcsw;
+    clock_gettime(CLOCK_MONOTONIC, &ctx->eco.start);
+    return 0;
+}
+
+static double eco_wakeups_per_min(Context *ctx) {
+    struct timespec now;
+    struct rusage usage;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    getrusage(RUSAGE_SELF, &usage);
+    double minutes = (now.tv_sec - ctx->eco.start.tv_sec +
+        (now.tv_nsec - ctx->eco.start.tv_nsec) / 1e9) / 60;
+    return minutes > 0 ? (usage.ru_nvcsw - ctx->eco.start_nvcsw) / minutes : 0;
+}
+
+/* Path of a file of the GPU's PCI function in sysfs, whose names are in
+ * lower case unlike NVML bus IDs. */
+static void pci_sysfs_path(Context *ctx, unsigned int row, const char *name, char *path, size_t size) {
+    char bus_id[BUS_ID_SIZE];
+    for (int i = 0; i < BUS_ID_SIZE; i++) bus_id[i] = (char)tolower((unsigned char)ctx->bus_ids[row][i]);
+    snprintf(path, size, "%s/bus/pci/devices/%s/%s", ctx->sysfs_root, bus_id, name);
+}
+
+/* Reads the runtime PM state of the GPU's PCI function from sysfs, which,
+ * unlike NVML or a register read, does not resume a suspended GPU. GPUs
+ * without runtime PM count as awake. */
+static int gpu_runtime_suspended(Context *ctx, unsigned int row) {
+    char path[PATH_MAX], status[32];
+    pci_sysfs_path(ctx, row, "power/runtime_status", path, sizeof(path));
+    return read_sysfs_line(AT_FDCWD, path, status, sizeof(status)) == 0 &&
+        strcmp(status, "suspended") == 0;
+}
+
+/* Sleep time until the next sample; longer while every GPU is suspended. */
+static int sample_interval_ms(Context *ctx) {
+    unsigned int interval = ctx->config.interval_ms;
+    unsigned int present = 0;
+    for (unsigned int row = 0; row < ctx->device_count; row++) present += ctx->present[row];
+    if (ctx->eco.enabled && present > 0 && ctx->eco.suspended == present &&
+        interval < ECO_SUSPENDED_INTERVAL_MS)
+        interval = ECO_SUSPENDED_INTERVAL_MS;
+    return (int)interval;
+}
+
+static void report_eco(Context *ctx) {
+    if (ctx->eco.enabled) fprintf(stderr, "%.1f wakeups per minute\n", eco_wakeups_per_min(ctx));
+}
+
+static int get_device_handle(Context *ctx, unsigned int index, nvmlDevice_t *device) {
+    uint64_t start_ns = nvml_probe_start();
+    ctx->result = nvml.nvmlDeviceGetHandleByIndex(index, device);
+    nvml_probe_end("nvmlDeviceGetHandleByIndex", index, ctx->result, start_ns);
+    if (NVML_SUCCESS != ctx->result) {
+        fprintf(stderr, "Failed to get handle for GPU %u: %s\n",
+          index, nvml.nvmlErrorString(ctx->result));
+        return -1;
+    }
+    return 0;
+}
+
+static int get_device_pci_info(Context *ctx, unsigned int index, nvmlDevice_t device,
+                               nvmlPciInfo_t *pci_info) {
+    uint64_t start_ns = nvml_probe_start();
+    ctx->result = nvml.nvmlDeviceGetPciInfo(device, pci_info);
+    nvml_probe_end("nvmlDeviceGetPciInfo", index, ctx->result, start_ns);
+    if (NVML_SUCCESS != ctx->result) {
+        fprintf(stderr, "Failed to get PCI info: %s\n",
+          nvml.nvmlErrorString(ctx->result));
+        return -1;
+    }
+    return 0;
+}
+
+static int get_gpu_temp(unsigned int index, nvmlDevice_t device, uint32_t *temp) {
+    uint64_t start_ns = nvml_probe_start();
+    nvmlReturn_t result = nvml.nvmlDeviceGetTemperature(device, NVML_TEMPERATURE_GPU, temp);
+    nvml_probe_end("nvmlDeviceGetTemperature", index, result, start_ns);
+    if (NVML_SUCCESS != result) {
+        fprintf(stderr, "Failed to get GPU temperature: %s\n",
+          nvml.nvmlErrorString(result));
+        return -1;
+    }
+    return 0;
+}
+
+static int read_gpu_utilization(Context *ctx, unsigned int row, GpuDevice *gpu,
+                                unsigned int *utilization) {
+    nvmlUtilization_t rates;
+    uint64_t start_ns = nvml_probe_start();
+    nvmlReturn_t result = nvml.nvmlDeviceGetUtilizationRates(gpu->device, &rates);
+    nvml_probe_end("nvmlDeviceGetUtilizationRates", ctx->indices[row], result, start_ns);
+    if (NVML_SUCCESS != result) return -1;
+    *utilization = rates.gpu;
+    return 0;
+}
+
+/* Utilization and power for --baseline, --pcie and characterize. A GPU that
+ * reports neither is sampled as usual but left out of the baseline. */
+static void read_gpu_load(Context *ctx, unsigned int row, GpuDevice *gpu) {
+    unsigned int utilization;
+    if (read_gpu_utilization(ctx, row, gpu, &utilization) < 0) return;
+
+    uint64_t start_ns = nvml_probe_start();
+    nvmlReturn_t result = nvml.nvmlDeviceGetPowerUsage(gpu->device, &gpu->power_mw);
+    nvml_probe_end("nvmlDeviceGetPowerUsage", ctx->indices[row], result, start_ns);
+    if (NVML_SUCCESS != result) return;
+    gpu->utilization = utilization;
+    gpu->load_read = 1;
+}
+
+static void close_pcie_link(PcieLink *link) {
+    if (!link->opened) return;
+    for (int file = 0; file < PCIE_FILE_COUNT; file++) {
+        if (link->fds[file] >= 0) close(link->fds[file]);
+    }
+    memset(link, 0, sizeof(*link));
+}
+
+/* Opens the link files of a GPU's PCI function. A GPU that was reset or
+ * replugged gets a new sysfs node, so the best link seen starts over. */
+static int open_pcie_link(Context *ctx, unsigned int row, PcieLink *link) {
+    char path[PATH_MAX];
+    pci_sysfs_path(ctx, row, "", path, sizeof(path));
+    int dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0) return -1;
+
+    memset(link, 0, sizeof(*link));
+    for (int file = 0; file < PCIE_FILE_COUNT; file++)
+        link->fds[file] = openat(dir_fd, PCIE_FILES[file], O_RDONLY | O_CLOEXEC);
+    close(dir_fd);
+    link->opened = 1;
+    return 0;
+}
+
+/* Parses a link speed such as "16.0 GT/s PCIe" into tenths of GT/s, a link
+ * width, or the TOTAL_ERR_* line of an AER counter file. */
+static uint64_t parse_pcie_value(PcieFile file, const char *value) {
+    if (file == PCIE_SPEED || file == PCIE_MAX_SPEED) {
+        double speed = strtod(value, NULL);
+        return speed > 0 ? (uint64_t)(speed * 10 + 0.5) : 0;
+    }
+    if (file == PCIE_WIDTH || file == PCIE_MAX_WIDTH) return strtoull(value, NULL, 10);
+
+    const char *total = strstr(value, "TOTAL_ERR_");
+    total = total ? strchr(total, ' ') : NULL;
+    return total ? strtoull(total, NULL, 10) : 0;
+}
+
+/* With --pcie, reads the link of a GPU with pread() on its open files and
+ * flags it as downtrained while it is narrower than the widest link seen,
+ * or slower than the fastest one while busy: GPUs lower the speed by
+ * themselves when idle. Without a utilization reading, as with hwmon, only
+ * the width counts. The flag keeps the temperatures of its first sample.
+ * Returns -1 if the files are gone, i.e. the GPU left the bus; they are
+ * opened again on a later sample. */
+static int read_pcie_link(Context *ctx, unsigned int row, const GpuDevice *gpu) {
+    PcieLink *link = &ctx->links[row];
+    char value[PCIE_AER_SIZE];
+    if (!link->opened && open_pcie_link(ctx, row, link) < 0) return -1;
+
+    for (int file = 0; file < PCIE_FILE_COUNT; file++) {
+        if (link->fds[file] < 0) continue;
+        ssize_t n = pread(link->fds[file], value, sizeof(value) - 1, 0);
+        if (n < 0) {
+            close_pcie_link(link);
+            return -1;
+        }
+        value[n] = '\0';
+        link->values[file] = parse_pcie_value(file, value);
+    }
+
+    uint64_t speed = link->values[PCIE_SPEED], width = link->values[PCIE_WIDTH];
+    int busy = gpu->load_read && gpu->utilization >= BUSY_UTIL;
+    int downtrained = width < link->best_width || (busy && speed < link->best_speed);
+    if (width > link->best_width) link->best_width = width;
+    if (busy && speed > link->best_speed) link->best_speed = speed;
+    if (downtrained && !link->downtrained) {
+        link->since = time(NULL);
+        for (int field = 0; field < FIELD_COUNT; field++) link->temps[field] = field_value(gpu, field);
+    }
+    link->downtrained = downtrained;
+    return 0;
+}
+
+static void append_pcie_link(Context *ctx, unsigned int row) {
+    const PcieLink *link = &ctx->links[row];
+    buffer_append(ctx, ",\"pcie\":{\"speed\":%.1f,\"width\":%llu,\"max_speed\":%.1f,\"max_width\":%llu",
+        link->values[PCIE_SPEED] / 10.0, (unsigned long long)link->values[PCIE_WIDTH],
+        link->values[PCIE_MAX_SPEED] / 10.0, (unsigned long long)link->values[PCIE_MAX_WIDTH]);
+    if (link->fds[PCIE_AER_CORRECTABLE] >= 0) {
+        buffer_append(ctx, ",\"aer\":{\"correctable\":%llu,\"nonfatal\":%llu,\"fatal\":%llu}",
+            (unsigned long long)link->values[PCIE_AER_CORRECTABLE],
+            (unsigned long long)link->values[PCIE_AER_NONFATAL],
+            (unsigned long long)link->values[PCIE_AER_FATAL]);
+    }
+    if (link->downtrained) {
+        buffer_append(ctx, ",\"downtrained\":{\"since\":%ld", (long)link->since);
+        for (int field = 0; field < FIELD_COUNT; field++) {
+            if (ctx->config.fields & (1u << field))
+                buffer_append(ctx, ",\"%s\":%u", FIELD_NAMES[field], link->temps[field]);
+        }
+        buffer_append(ctx, "}");
+    }
+    buffer_append(ctx, "}");
+}
+
+static int init_pcie_links(Context *ctx) {
+    if (!ctx->pcie_enabled) return 0;
+    ctx->links = calloc(ctx->row_capacity, sizeof(*ctx->links));
+    if (!ctx->links) {
+        fprintf(stderr, "Failed to allocate PCIe link state\n");
+        return -1;
+    }
+    // GPUs whose sysfs node is missing are retried when sampled.
+    for (unsigned int row = 0; row < ctx->device_count; row++) open_pcie_link(ctx, row, &ctx->links[row]);
+    return 0;
+}
+
+static int init_quality(Context *ctx) {
+    ctx->quality = calloc(ctx->row_capacity, sizeof(*ctx->quality));
+    if (!ctx->quality) {
+        fprintf(stderr, "Failed to allocate sensor quality state\n");
+        return -1;
+    }
+    return 0;
+}
+
+/* Time since the previous sample of a row, for totals of time spent in some
+ * state. Measured, since samples can be late, but a gap much longer than the
+ * interval, e.g. while the GPU was suspended or gone, counts as one interval. */
+static uint64_t sample_gap_ms(const Context *ctx, uint64_t *last_ns, uint64_t now_ns) {
+    uint64_t gap_ms = *last_ns ? (now_ns - *last_ns) / 1000000 : ctx->config.interval_ms;
+    uint64_t max_ms = (uint64_t)ctx->config.interval_ms * SAMPLE_MAX_GAP_INTERVALS;
+    *last_ns = now_ns;
+    return gap_ms > max_ms && gap_ms > SAMPLE_MAX_GAP_MS ? ctx->config.interval_ms : gap_ms;
+}
+
+/* Whether the GPU is busy. Only asked while a reading has not changed, and
+ * the utilization is then read at most every QUALITY_BUSY_CACHE_MS unless
+ * the sample already has it, so the checks add no NVML call to most samples. */
+static int gpu_busy(Context *ctx, unsigned int row, GpuDevice *gpu, uint64_t now_ns) {
+    GpuQuality *quality = &ctx->quality[row];
+    if (gpu->load_read) {
+        quality->busy = gpu->utilization >= BUSY_UTIL;
+        quality->busy_ns = now_ns;
+    } else if (ctx->backend == BACKEND_NVIDIA &&
+               now_ns - quality->busy_ns >= QUALITY_BUSY_CACHE_MS * 1000000ULL) {
+        unsigned int utilization;
+        quality->busy = read_gpu_utilization(ctx, row, gpu, &utilization) == 0 &&
+            utilization >= BUSY_UTIL;
+        quality->busy_ns = now_ns;
+    }
+    return quality->busy;
+}
+
+/* Checks each reading against the previous ones and the core temperature
+ * and sets its quality flags:
+ * - slew: it moved further from the last plausible reading than
+ *   QUALITY_MAX_STEP plus QUALITY_MAX_SLEW per second allow. After
+ *   QUALITY_SLEW_SAMPLES such readings in a row the new level is accepted.
+ * - stuck: it has not changed for QUALITY_STUCK_BUSY_MS of samples with the
+ *   GPU busy or, for junction and VRAM, for at least QUALITY_STUCK_MIN_MS
+ *   while the core moved by QUALITY_STUCK_CORE_RANGE. The latter also works
+ *   without a utilization reading, as with hwmon.
+ * - core: the junction is below the core, or junction or VRAM are more than
+ *   QUALITY_MAX_SPREAD away from it.
+ * A missing sensor, which reads 0, is not checked. */
+static void check_quality(Context *ctx, unsigned int row, GpuDevice *gpu) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t now_ns = timespec_ns(&now);
+    uint32_t core = gpu->gpu_temp;
+
+    for (int field = 0; field < FIELD_COUNT; field++) {
+        SensorQuality *sensor = &ctx->quality[row].sensors[field];
+        uint32_t temp = field_value(gpu, field);
+        uint8_t flags = 0;
+        if (temp == 0) continue;
+        if (!sensor->accepted_ns) {
+            *sensor = (SensorQuality){temp, temp, now_ns, now_ns, now_ns, 0, core, core, 0};
+            continue;
+        }
+        uint64_t elapsed_ms = sample_gap_ms(ctx, &sensor->checked_ns, now_ns);
+
+        double seconds = (now_ns - sensor->accepted_ns) / 1e9;
+        uint32_t step = temp > sensor->accepted ? temp - sensor->accepted : sensor->accepted - temp;
+        if (step > QUALITY_MAX_STEP[field] + QUALITY_MAX_SLEW[field] * seconds &&
+            ++sensor->rejected < QUALITY_SLEW_SAMPLES) {
+            flags |= 1u << QUALITY_SLEW;
+        } else {
+            sensor->accepted = temp;
+            sensor->accepted_ns = now_ns;
+            sensor->rejected = 0;
+        }
+
+        if (temp != sensor->last) {
+            sensor->changed_ns = now_ns;
+            sensor->busy_ms = 0;
+            sensor->core_min = sensor->core_max = core;
+        } else {
+            if (core < sensor->core_min) sensor->core_min = core;
+            if (core > sensor->core_max) sensor->core_max = core;
+            if (gpu_busy(ctx, row, gpu, now_ns)) sensor->busy_ms += (uint32_t)elapsed_ms;
+            if (sensor->busy_ms >= QUALITY_STUCK_BUSY_MS ||
+                (field != FIELD_CORE && now_ns - sensor->changed_ns >= QUALITY_STUCK_MIN_MS * 1000000ULL &&
+                 sensor->core_max - sensor->core_min >= QUALITY_STUCK_CORE_RANGE))
+                flags |= 1u << QUALITY_STUCK;
+        }
+        sensor->last = temp;
+
+        if (field != FIELD_CORE && core &&
+            ((field == FIELD_JUNCTION && temp + QUALITY_JUNCTION_BELOW < core) ||
+             temp > core + QUALITY_MAX_SPREAD || temp + QUALITY_MAX_SPREAD < core))
+            flags |= 1u << QUALITY_CORE;
+        gpu->quality[field] = flags;
+    }
+}
+
+static void append_quality(Context *ctx, const GpuDevice *gpu) {
+    int first = 1;
+    for (int field = 0; field < FIELD_COUNT; field++) {
+        if (!gpu->quality[field] || !(ctx->config.fields & (1u << field))) continue;
+        buffer_append(ctx, "%s\"%s\":[", first ? ",\"quality\":{" : ",", FIELD_NAMES[field]);
+        for (int flag = 0, first_flag = 1; flag < QUALITY_COUNT; flag++) {
+            if (!(gpu->quality[field] & (1u << flag))) continue;
+            buffer_append(ctx, "%s\"%s\"", first_flag ? "" : ",", QUALITY_NAMES[flag]);
+            first_flag = 0;
+        }
+        buffer_append(ctx, "]");
+        first = 0;
+    }
+    if (!first) buffer_append(ctx, "}");
+}
+
+static uint32_t decode_register(const RegisterField *reg, uint32_t value) {
+    return (value >> reg->shift) & ((1u << reg->width) - 1);
+}
+
+static void decode_batch_scalar(const RegisterField *reg, const uint32_t *raw,
+                                uint8_t *temps, uint8_t *valid, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        temps[i] = (uint8_t)decode_register(reg, raw[i]);
+        valid[i] = temps[i] < 0x7f;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static void decode_batch_sse2(const RegisterField *reg, const uint32_t *raw,
+                              uint8_t *temps, uint8_t *valid, size_t count) {
+    const __m128i shift = _mm_cvtsi32_si128(reg->shift);
+    const __m128i mask = _mm_set1_epi32((1u << reg->width) - 1);
+    const __m128i max_valid = _mm_set1_epi8(0x7e);
+    const __m128i one = _mm_set1_epi8(1);
+    size_t i = 0;
+
+    for (; i + 16 <= count; i += 16) {
+        __m128i a = _mm_and_si128(_mm_srl_epi32(_mm_loadu_si128((const __m128i *)&raw[i]), shift), mask);
+        __m128i b = _mm_and_si128(_mm_srl_epi32(_mm_loadu_si128((const __m128i *)&raw[i + 4]), shift), mask);
+        __m128i c = _mm_and_si128(_mm_srl_epi32(_mm_loadu_si128((const __m128i *)&raw[i + 8]), shift), mask);
+        __m128i d = _mm_and_si128(_mm_srl_epi32(_mm_loadu_si128((const __m128i *)&raw[i + 12]), shift), mask);
+        __m128i t = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+        __m128i ok = _mm_and_si128(_mm_cmpeq_epi8(_mm_min_epu8(t, max_valid), t), one);
+        _mm_storeu_si128((__m128i *)&temps[i], t);
+        _mm_storeu_si128((__m128i *)&valid[i], ok);
+    }
+    decode_batch_scalar(reg, raw + i, temps + i, valid + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void decode_batch_avx2(const RegisterField *reg, const uint32_t *raw,
+                              uint8_t *temps, uint8_t *valid, size_t count) {
+    const __m128i shift = _mm_cvtsi32_si128(reg->shift);
+    const __m256i mask = _mm256_set1_epi32((1u << reg->width) - 1);
+    const __m256i max_valid = _mm256_set1_epi8(0x7e);
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    size_t i = 0;
+
+    for (; i + 32 <= count; i += 32) {
+        __m256i a = _mm256_and_si256(_mm256_srl_epi32(_mm256_loadu_si256((const __m256i *)&raw[i]), shift), mask);
+        __m256i b = _mm256_and_si256(_mm256_srl_epi32(_mm256_loadu_si256((const __m256i *)&raw[i + 8]), shift), mask);
+        __m256i c = _mm256_and_si256(_mm256_srl_epi32(_mm256_loadu_si256((const __m256i *)&raw[i + 16]), shift), mask);
+        __m256i d = _mm256_and_si256(_mm256_srl_epi32(_mm256_loadu_si256((const __m256i *)&raw[i + 24]), shift), mask);
+        // The packs work per 128-bit lane; the permute restores word order.
+        __m256i t = _mm256_permutevar8x32_epi32(
+            _mm256_packus_epi16(_mm256_packus_epi32(a, b), _mm256_packus_epi32(c, d)), order);
+        __m256i ok = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(t, max_valid), t), one);
+        _mm256_storeu_si256((__m256i *)&temps[i], t);
+        _mm256_storeu_si256((__m256i *)&valid[i], ok);
+    }
+    decode_batch_sse2(reg, raw + i, temps + i, valid + i, count - i);
+}
+#elif defined(__ARM_NEON)
+static void decode_batch_neon(const RegisterField *reg, const uint32_t *raw,
+                              uint8_t *temps, uint8_t *valid, size_t count) {
+    const int32x4_t shift = vdupq_n_s32(-(int32_t)reg->shift);
+    const uint32x4_t mask = vdupq_n_u32((1u << reg->width) - 1);
+    const uint8x16_t limit = vdupq_n_u8(0x7f);
+    const uint8x16_t one = vdupq_n_u8(1);
+    size_t i = 0;
+
+    for (; i + 16 <= count; i += 16) {
+        uint32x4_t a = vandq_u32(vshlq_u32(vld1q_u32(&raw[i]), shift), mask);
+        uint32x4_t b = vandq_u32(vshlq_u32(vld1q_u32(&raw[i + 4]), shift), mask);
+        uint32x4_t c = vandq_u32(vshlq_u32(vld1q_u32(&raw[i + 8]), shift), mask);
+        uint32x4_t d = vandq_u32(vshlq_u32(vld1q_u32(&raw[i + 12]), shift), mask);
+        uint16x8_t ab = vcombine_u16(vmovn_u32(a), vmovn_u32(b));
+        uint16x8_t cd = vcombine_u16(vmovn_u32(c), vmovn_u32(d));
+        uint8x16_t t = vcombine_u8(vmovn_u16(ab), vmovn_u16(cd));
+        vst1q_u8(&temps[i], t);
+        vst1q_u8(&valid[i], vandq_u8(vcltq_u8(t, limit), one));
+    }
+    decode_batch_scalar(reg, raw + i, temps + i, valid + i, count - i);
+}
+#endif
+
+/* Decodes count raw words of one register at once: temps[i] is the decoded
+ * value and valid[i] is 1 when it passes the same < 0x7f check as
+ * read_register_temp(). Fields are at most 8 bits wide. Uses AVX2 when the
+ * CPU has it, otherwise SSE2 or NEON, and plain C elsewhere. */
+static void decode_register_batch(const RegisterField *reg, const uint32_t *raw,
+                                  uint8_t *temps, uint8_t *valid, size_t count) {
+#if defined(__x86_64__) || defined(__i386__)
+    static int has_avx2 = -1;
+    if (has_avx2 < 0) has_avx2 = __builtin_cpu_supports("avx2");
+    if (has_avx2) {
+        decode_batch_avx2(reg, raw, temps, valid, count);
+    } else {
+        decode_batch_sse2(reg, raw, temps, valid, count);
+    }
+#elif defined(__ARM_NEON)
+    decode_batch_neon(reg, raw, temps, valid, count);
+#else
+    decode_batch_scalar(reg, raw, temps, valid, count);
+#endif
+}
+
+static void sort_u8(uint8_t *values, unsigned int count) {
+    for (unsigned int i = 1; i < count; i++) {
+        uint8_t value = values[i];
+        unsigned int j = i;
+        for (; j > 0 && values[j - 1] > value; j--) values[j] = values[j - 1];
+        values[j] = value;
+    }
+}
+
+/* Reduces count back-to-back loads of one register to a reading: words that
+ * decode to 0x7f or more are rejected, the rest give their median or the mean
+ * of their middle half, and raw is set to the load closest to the reading.
+ * If every word is rejected, the first one is returned as is. */
+static uint32_t filter_register_words(Filter filter, const RegisterField *reg,
+                                      const uint32_t *words, unsigned int count,
+                                      uint32_t *raw, uint8_t *spread, uint8_t *rejected) {
+    uint8_t temps[OVERSAMPLE_MAX], valid[OVERSAMPLE_MAX], sorted[OVERSAMPLE_MAX];
+    unsigned int n = 0;
+
+    decode_register_batch(reg, words, temps, valid, count);
+    for (unsigned int i = 0; i < count; i++) {
+        if (valid[i]) sorted[n++] = temps[i];
+    }
+    *rejected = (uint8_t)(count - n);
+    *spread = 0;
+    *raw = words[0];
+    if (n == 0) return temps[0];
+
+    sort_u8(sorted, n);
+    *spread = sorted[n - 1] - sorted[0];
+    uint32_t temp;
+    if (filter == FILTER_TRIMMED && n > 2) {
+        unsigned int trim = n / 4, sum = 0;
+        for (unsigned int i = trim; i < n - trim; i++) sum += sorted[i];
+        temp = (sum + (n - 2 * trim) / 2) / (n - 2 * trim);
+    } else {
+        temp = (sorted[(n - 1) / 2] + sorted[n / 2] + 1) / 2;
+    }
+
+    unsigned int closest = UINT32_MAX;
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned int distance = temps[i] > temp ? temps[i] - temp : temp - temps[i];
+        if (valid[i] && distance < closest) {
+            closest = distance;
+            *raw = words[i];
+        }
+    }
+    return temp;
+}
+
+static int read_register_temp(Context *ctx, unsigned int row, struct pci_dev *dev,
+                              const RegisterField *reg, uint32_t *raw, uint32_t *temp,
+                              uint8_t *spread, uint8_t *rejected) {
+    int fd = open(ctx->mem_path, O_RDONLY | O_SYNC);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open %s: %s\n", ctx->mem_path, strerror(errno));
+        return -1;
+    }
+
+    uint32_t reg_addr = (dev->base_addr[0] & 0xFFFFFFFF) + reg->offset;
+    uint32_t base_offset = reg_addr & ~(PG_SZ-1);
+    void *map_base = mmap(0, PG_SZ, PROT_READ, MAP_SHARED, fd, base_offset);
+    if (map_base == MAP_FAILED) {
+        fprintf(stderr, "Failed to map memory: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    stage_end(ctx, row, STAGE_MAP);
+
+    // With --oversample the loads run back to back on the same mapping.
+    const volatile uint32_t *word = (const volatile uint32_t *)((char *)map_base + (reg_addr - base_offset));
+    uint32_t words[OVERSAMPLE_MAX] = {*word};
+    unsigned int loads = ctx->config.oversample;
+    for (unsigned int i = 1; i < loads; i++) words[i] = *word;
+    stage_end(ctx, row, STAGE_LOAD);
+
+    *temp = filter_register_words(ctx->config.filter, reg, words, loads, raw, spread, rejected);
+    PROBE4(register_read, ctx->indices[row], reg->offset, *raw, *temp);
+    stage_end(ctx, row, STAGE_DECODE);
+
+    munmap(map_base, PG_SZ);
+    close(fd);
+    stage_end(ctx, row, STAGE_UNMAP);
+
+    return (*temp < 0x7f) ? 0 : -1;
+}
+
+static struct pci_dev *find_pci_dev(Context *ctx, const nvmlPciInfo_t *pci_info) {
+    for (struct pci_dev *dev = ctx->pacc->devices; dev; dev = dev->next) {
+        pci_fill_info(dev, PCI_FILL_IDENT | PCI_FILL_BASES);
+
+        if ((dev->device_id << 16 | dev->vendor_id) == pci_info->pciDeviceId &&
+            (unsigned int)dev->domain == pci_info->domain &&
+            dev->bus == pci_info->bus &&
+            dev->dev == pci_info->device) {
+            return dev;
+        }
+    }
+    return NULL;
+}
+
+static int read_hwmon_temp(int fd, uint32_t *temp) {
+    char value[16];
+    ssize_t n = pread(fd, value, sizeof(value) - 1, 0);
+    if (n <= 0) return -1;
+    value[n] = '\0';
+    long millidegrees = strtol(value, NULL, 10);
+    *temp = millidegrees > 0 ? (uint32_t)((millidegrees + 500) / 1000) : 0;
+    return 0;
+}
+
+/* Fills the same fields as the NVIDIA path: edge as core, junction, and mem
+ * as VRAM. Sensors the card does not have read as 0. */
+static int read_hwmon_temps(Context *ctx, unsigned int row, GpuDevice *gpu) {
+    const HwmonDevice *device = &ctx->hwmon[ctx->indices[row]];
+    uint32_t *temps[FIELD_COUNT] = {&gpu->gpu_temp, &gpu->junction_temp, &gpu->vram_temp};
+
+    stage_start(ctx);
+    for (int field = 0; field < FIELD_COUNT; field++) {
+        if (device->fds[field] < 0) continue;
+        if (read_hwmon_temp(device->fds[field], temps[field]) < 0) {
+            fprintf(stderr, "Failed to read %s temperature of %s: %s\n",
+                HWMON_LABELS[field], device->bus_id, strerror(errno));
+            return -1;
+        }
+    }
+    stage_end(ctx, row, STAGE_LOAD);
+    return 0;
+}
+
+static int read_gpu_temps(Context *ctx, unsigned int row, GpuDevice *gpu) {
+    if (ctx->backend == BACKEND_HWMON) return read_hwmon_temps(ctx, row, gpu);
+
+    unsigned int index = ctx->indices[row];
+    stage_start(ctx);
+    if (get_device_handle(ctx, index, &gpu->device) < 0) return -1;
+    stage_end(ctx, row, STAGE_HANDLE);
+    if (get_gpu_temp(index, gpu->device, &gpu->gpu_temp) < 0) return -1;
+    stage_end(ctx, row, STAGE_NVML_TEMP);
+    if (get_device_pci_info(ctx, index, gpu->device, &gpu->pci_info) < 0) return -1;
+    stage_end(ctx, row, STAGE_PCI_INFO);
+    // After a reset or hot-unplug the index may name another GPU.
+    if (strncmp(gpu->pci_info.busIdLegacy, ctx->bus_ids[row], BUS_ID_SIZE) != 0) return -1;
+
+    struct pci_dev *dev = find_pci_dev(ctx, &gpu->pci_info);
+    if (!dev) return -1;
+    stage_end(ctx, row, STAGE_PCI_MATCH);
+
+    gpu->registers_read = 1;
+    int junction_result = read_register_temp(ctx, row, dev, &REGISTERS[REG_JUNCTION],
+      &gpu->raw[REG_JUNCTION], &gpu->junction_temp,
+      &gpu->spread[REG_JUNCTION], &gpu->rejected[REG_JUNCTION]);
+    int vram_result = read_register_temp(ctx, row, dev, &REGISTERS[REG_VRAM],
+      &gpu->raw[REG_VRAM], &gpu->vram_temp,
+      &gpu->spread[REG_VRAM], &gpu->rejected[REG_VRAM]);
+
+    return (junction_result == 0 && vram_result == 0) ? 0 : -1;
+}
+
+/* Raw captures are little-endian binary files: a header, then one fixed-size
+ * record per GPU per sample. See "Raw register captures" in the README. */
+static void put_u16(unsigned char *p, uint16_t v) {
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+static void put_u32(unsigned char *p, uint32_t v) {
+    put_u16(p, v & 0xffff);
+    put_u16(p + 2, v >> 16);
+}
+
+static void put_u64(unsigned char *p, uint64_t v) {
+    put_u32(p, v & 0xffffffff);
+    put_u32(p + 4, v >> 32);
+}
+
+static uint16_t get_u16(const unsigned char *p) {
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t get_u32(const unsigned char *p) {
+    return get_u16(p) | (uint32_t)get_u16(p + 2) << 16;
+}
+
+static uint64_t get_u64(const unsigned char *p) {
+    return get_u32(p) | (uint64_t)get_u32(p + 4) << 32;
+}
+
+static size_t raw_record_size(uint32_t register_count) {
+    return RAW_RECORD_HEADER_SIZE + register_count * (sizeof(uint32_t) + 1);
+}
+
+static void write_raw_record(Context *ctx, unsigned int row, GpuDevice *gpu) {
+    unsigned char record[RAW_RECORD_HEADER_SIZE + REG_COUNT * (sizeof(uint32_t) + 1)];
+    uint32_t decoded[REG_COUNT] = {gpu->junction_temp, gpu->vram_temp};
+    struct timespec now;
+    uint8_t valid = 0;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    put_u64(record, timespec_ns(&now) / 1000);
+    put_u16(record + 8, (uint16_t)row);
+    record[10] = (uint8_t)gpu->gpu_temp;
+    for (int reg = 0; reg < REG_COUNT; reg++) {
+        if (decoded[reg] < 0x7f) valid |= 1u << reg;
+        put_u32(record + RAW_RECORD_HEADER_SIZE + reg * sizeof(uint32_t), gpu->raw[reg]);
+        record[RAW_RECORD_HEADER_SIZE + REG_COUNT * sizeof(uint32_t) + reg] = (uint8_t)decoded[reg];
+    }
+    record[11] = valid;
+    fwrite(record, sizeof(record), 1, ctx->raw);
+}
+
+static FILE *open_raw_capture(Context *ctx, const char *path) {
+    FILE *raw = fopen(path, "wb");
+    if (!raw) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    setvbuf(raw, NULL, _IOFBF, RAW_BUFFER_SIZE);
+
+    unsigned char header[24] = RAW_MAGIC;
+    put_u32(header + 8, RAW_VERSION);
+    put_u32(header + 12, ctx->device_count);
+    put_u32(header + 16, REG_COUNT);
+    put_u32(header + 20, (uint32_t)raw_record_size(REG_COUNT));
+    fwrite(header, sizeof(header), 1, raw);
+
+    for (int reg = 0; reg < REG_COUNT; reg++) {
+        unsigned char entry[8 + RAW_NAME_SIZE] = {0};
+        put_u32(entry, REGISTERS[reg].offset);
+        entry[4] = REGISTERS[reg].shift;
+        entry[5] = REGISTERS[reg].width;
+        memcpy(entry + 8, REGISTERS[reg].name, strnlen(REGISTERS[reg].name, RAW_NAME_SIZE));
+        fwrite(entry, sizeof(entry), 1, raw);
+    }
+
+    for (unsigned int i = 0; i < ctx->device_count; i++) {
+        unsigned char entry[4 + RAW_BUS_ID_SIZE] = {0};
+        if (!ctx->present[i]) {
+            // A lost GPU keeps its row; only its bus ID is still known.
+            memcpy(entry + 4, ctx->bus_ids[i], strnlen(ctx->bus_ids[i], RAW_BUS_ID_SIZE));
+            fwrite(entry, sizeof(entry), 1, raw);
+            continue;
+        }
+        nvmlDevice_t device;
+        nvmlPciInfo_t pci_info;
+        if ((get_device_handle(ctx, ctx->indices[i], &device) < 0) ||
+            (get_device_pci_info(ctx, ctx->indices[i], device, &pci_info) < 0)) {
+            fclose(raw);
+            return NULL;
+        }
+        put_u32(entry, pci_info.pciDeviceId);
+        memcpy(entry + 4, pci_info.busIdLegacy, strnlen(pci_info.busIdLegacy, RAW_BUS_ID_SIZE));
+        fwrite(entry, sizeof(entry), 1, raw);
+    }
+
+    if (ferror(raw)) {
+        fprintf(stderr, "Failed to write %s: %s\n", path, strerror(errno));
+        fclose(raw);
+        return NULL;
+    }
+    ctx->raw_rows = ctx->device_count;
+    return raw;
+}
+
+static int init_raw_capture(Context *ctx) {
+    if (!ctx->config.raw_path[0]) return 0;
+    ctx->raw = open_raw_capture(ctx, ctx->config.raw_path);
+    return ctx->raw ? 0 : -1;
+}
+
+/* Baseline files are little-endian too: a header, then BASELINE_RECORD_SIZE
+ * bytes per GPU, its UUID followed by a count and a sum of readings per load
+ * bin and field. */
+static int load_baseline(Context *ctx) {
+    Baseline *baseline = &ctx->baseline;
+    FILE *file = fopen(baseline->path, "rb");
+    if (!file) {
+        // --learn starts a new baseline.
+        if (errno == ENOENT && baseline->learn) return 0;
+        fprintf(stderr, "Failed to open %s: %s\n", baseline->path, strerror(errno));
+        return -1;
+    }
+
+    unsigned char header[24];
+    int result = -1;
+    if (fread(header, sizeof(header), 1, file) != 1 ||
+        memcmp(header, BASELINE_MAGIC, sizeof(BASELINE_MAGIC)) != 0 ||
+        get_u32(header + 8) != BASELINE_VERSION) {
+        fprintf(stderr, "%s is not a gputemps baseline\n", baseline->path);
+    } else if (get_u16(header + 12) != BASELINE_UTIL_BINS ||
+               get_u16(header + 14) != BASELINE_POWER_BINS ||
+               get_u16(header + 16) != FIELD_COUNT) {
+        fprintf(stderr, "%s was built with different load bins\n", baseline->path);
+    } else {
+        uint32_t count = get_u32(header + 20);
+        baseline->profiles = calloc(count ? count : 1, sizeof(*baseline->profiles));
+        if (!baseline->profiles) {
+            fprintf(stderr, "Failed to allocate baseline\n");
+            fclose(file);
+            return -1;
+        }
+        result = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            unsigned char record[BASELINE_RECORD_SIZE];
+            if (fread(record, sizeof(record), 1, file) != 1) {
+                fprintf(stderr, "%s is truncated\n", baseline->path);
+                result = -1;
+                break;
+            }
+            BaselineProfile *profile = &baseline->profiles[i];
+            memcpy(profile->uuid, record, UUID_SIZE);
+            profile->uuid[UUID_SIZE - 1] = '\0';
+            const unsigned char *p = record + UUID_SIZE;
+            for (int bin = 0; bin < BASELINE_BINS; bin++) {
+                for (int field = 0; field < FIELD_COUNT; field++, p += 12) {
+                    profile->count[bin][field] = get_u32(p);
+                    profile->sum[bin][field] = get_u64(p + 4);
+                }
+            }
+            baseline->profile_count++;
+        }
+    }
+    fclose(file);
+    return result;
+}
+
+/* Writes the profiles to FILE.tmp and renames it over FILE, with write(2)
+ * and one record at a time on the stack, so saving does not allocate. */
+static int save_baseline(Context *ctx) {
+    Baseline *baseline = &ctx->baseline;
+    char path[PATH_MAX];
+    clock_gettime(CLOCK_MONOTONIC, &baseline->saved);
+    if (snprintf(path, sizeof(path), "%s.tmp", baseline->path) >= (int)sizeof(path)) {
+        fprintf(stderr, "Baseline path too long: %s\n", baseline->path);
+        return -1;
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    unsigned char header[24] = BASELINE_MAGIC;
+    put_u32(header + 8, BASELINE_VERSION);
+    put_u16(header + 12, BASELINE_UTIL_BINS);
+    put_u16(header + 14, BASELINE_POWER_BINS);
+    put_u16(header + 16, FIELD_COUNT);
+    put_u32(header + 20, baseline->profile_count);
+    int result = write_all(fd, header, sizeof(header));
+    for (unsigned int i = 0; result == 0 && i < baseline->profile_count; i++) {
+        const BaselineProfile *profile = &baseline->profiles[i];
+        unsigned char record[BASELINE_RECORD_SIZE];
+        memcpy(record, profile->uuid, UUID_SIZE);
+        unsigned char *p = record + UUID_SIZE;
+        for (int bin = 0; bin < BASELINE_BINS; bin++) {
+            for (int field = 0; field < FIELD_COUNT; field++, p += 12) {
+                put_u32(p, profile->count[bin][field]);
+                put_u64(p + 4, profile->sum[bin][field]);
+            }
+        }
+        result = write_all(fd, record, sizeof(record));
+    }
+    if (close(fd) < 0) result = -1;
+    if (result < 0 || rename(path, baseline->path) < 0) {
+        fprintf(stderr, "Failed to write %s: %s\n", baseline->path, strerror(errno));
+        unlink(path);
+        return -1;
+    }
+    return 0;
+}
+
+/* Profiles persisted across restarts are keyed by the GPU's UUID, which,
+ * unlike its index or bus ID, follows the card. */
+static int get_gpu_uuid(Context *ctx, unsigned int index, nvmlDevice_t device, char *uuid) {
+    memset(uuid, 0, UUID_SIZE);
+    uint64_t start_ns = nvml_probe_start();
+    ctx->result = nvml.nvmlDeviceGetUUID(device, uuid, UUID_SIZE);
+    nvml_probe_end("nvmlDeviceGetUUID", index, ctx->result, start_ns);
+    if (NVML_SUCCESS != ctx->result) {
+        fprintf(stderr, "Failed to get UUID of GPU %u: %s\n", index, nvml.nvmlErrorString(ctx->result));
+        return -1;
+    }
+    return 0;
+}
+
+/* Finds the profile of the GPU in a row by UUID, or starts an empty one. */
+static int attach_baseline_row(Context *ctx, unsigned int row) {
+    Baseline *baseline = &ctx->baseline;
+    BaselineRow *state = &baseline->rows[row];
+    unsigned int index = ctx->indices[row];
+    char uuid[UUID_SIZE];
+    nvmlDevice_t device;
+    if ((get_device_handle(ctx, index, &device) < 0) ||
+        (get_gpu_uuid(ctx, index, device, uuid) < 0))
+        return -1;
+
+    // Without a known limit, the power bins stay at 0 and only utilization counts.
+    uint64_t start_ns = nvml_probe_start();
+    ctx->result = nvml.nvmlDeviceGetEnforcedPowerLimit(device, &state->power_limit_mw);
+    nvml_probe_end("nvmlDeviceGetEnforcedPowerLimit", index, ctx->result, start_ns);
+    if (NVML_SUCCESS != ctx->result) state->power_limit_mw = 0;
+
+    unsigned int i = 0;
+    while (i < baseline->profile_count && strcmp(baseline->profiles[i].uuid, uuid) != 0) i++;
+    if (i == baseline->profile_count) {
+        BaselineProfile *profiles = realloc(baseline->profiles, (i + 1) * sizeof(*profiles));
+        if (!profiles) {
+            fprintf(stderr, "Failed to allocate baseline for GPU %u\n", index);
+            return -1;
+        }
+        memset(&profiles[i], 0, sizeof(*profiles));
+        memcpy(profiles[i].uuid, uuid, sizeof(uuid));
+        baseline->profiles = profiles;
+        baseline->profile_count++;
+    }
+    state->profile = (int)i;
+    return 0;
+}
+
+static int init_baseline(Context *ctx) {
+    Baseline *baseline = &ctx->baseline;
+    if (!baseline->path) return 0;
+    if (load_baseline(ctx) < 0) return -1;
+
+    baseline->rows = calloc(ctx->row_capacity, sizeof(*baseline->rows));
+    if (!baseline->rows) {
+        fprintf(stderr, "Failed to allocate baseline\n");
+        return -1;
+    }
+    for (unsigned int row = 0; row < ctx->device_count; row++) {
+        if (attach_baseline_row(ctx, row) < 0) return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &baseline->saved);
+    return 0;
+}
+
+static int handle_baseline_save(Context *ctx) {
+    struct timespec now;
+    if (!ctx->baseline.learn) return 0;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec - ctx->baseline.saved.tv_sec < BASELINE_SAVE_INTERVAL) return 0;
+    return save_baseline(ctx);
+}
+
+static unsigned int baseline_bin(const BaselineRow *state, const GpuDevice *gpu) {
+    unsigned int util = gpu->utilization * BASELINE_UTIL_BINS / 100;
+    unsigned int power = state->power_limit_mw ?
+        (unsigned int)((uint64_t)gpu->power_mw * BASELINE_POWER_BINS / state->power_limit_mw) : 0;
+    if (util >= BASELINE_UTIL_BINS) util = BASELINE_UTIL_BINS - 1;
+    if (power >= BASELINE_POWER_BINS) power = BASELINE_POWER_BINS - 1;
+    return util * BASELINE_POWER_BINS + power;
+}
+
+/* With --learn, adds a sample to the GPU's profile. Otherwise compares it
+ * with the profile's mean in the same load bin, which costs one division and
+ * one moving average update per field. Temperatures lag the load, so only
+ * samples after BASELINE_SETTLE in the same bin count. Returns the field
+ * whose average deviation is the highest at or above config.regression, or
+ * -1. */
+static int update_baseline(Context *ctx, unsigned int row, const GpuDevice *gpu,
+                           unsigned int *bin, float *by) {
+    if (!ctx->baseline.rows) return -1;
+    BaselineRow *state = &ctx->baseline.rows[row];
+    BaselineProfile *profile = &ctx->baseline.profiles[state->profile];
+    int regressed = -1;
+    *bin = baseline_bin(state, gpu);
+    *by = (float)ctx->config.regression;
+
+    if (*bin != state->last_bin) state->settled = 0;
+    state->last_bin = *bin;
+    if (state->settled < BASELINE_SETTLE) {
+        state->settled++;
+        return -1;
+    }
+
+    for (int field = 0; field < FIELD_COUNT; field++) {
+        uint32_t temp = field_value(gpu, field);
+        if (temp == 0) continue;
+        if (ctx->baseline.learn) {
+            profile->count[*bin][field]++;
+            profile->sum[*bin][field] += temp;
+            continue;
+        }
+
+        uint32_t count = profile->count[*bin][field];
+        if (count < BASELINE_MIN_SAMPLES) continue;
+        float deviation = temp - (float)profile->sum[*bin][field] / count;
+        float *average = &state->deviation[*bin][field];
+        uint16_t *live = &state->live[*bin][field];
+        *average = *live ? *average + (deviation - *average) / BASELINE_SMOOTHING : deviation;
+        if (*live < UINT16_MAX) (*live)++;
+        if (*live >= BASELINE_MIN_LIVE && *average >= *by) {
+            *by = *average;
+            regressed = field;
+        }
+    }
+    return regressed;
+}
+
+/* ECC profile files use the same layout as baselines: a header, then
+ * ECC_RECORD_SIZE bytes per GPU, its UUID followed by the exposure in
+ * milliseconds and the error count per counter, for each VRAM bin. */
+static int load_ecc(Context *ctx) {
+    Ecc *ecc = &ctx->ecc;
+    FILE *file = fopen(ecc->path, "rb");
+    if (!file) {
+        if (errno == ENOENT) return 0;
+        fprintf(stderr, "Failed to open %s: %s\n", ecc->path, strerror(errno));
+        return -1;
+    }
+
+    unsigned char header[24];
+    int result = -1;
+    if (fread(header, sizeof(header), 1, file) != 1 ||
+        memcmp(header, ECC_MAGIC, sizeof(ECC_MAGIC)) != 0 ||
+        get_u32(header + 8) != ECC_VERSION) {
+        fprintf(stderr, "%s is not a gputemps ECC profile\n", ecc->path);
+    } else if (get_u16(header + 12) != ECC_BINS ||
+               get_u16(header + 14) != ECC_BIN_WIDTH ||
+               get_u16(header + 16) != ECC_COUNTER_COUNT) {
+        fprintf(stderr, "%s was built with different temperature bins\n", ecc->path);
+    } else {
+        uint32_t count = get_u32(header + 20);
+        ecc->profiles = calloc(count ? count : 1, sizeof(*ecc->profiles));
+        if (!ecc->profiles) {
+            fprintf(stderr, "Failed to allocate ECC profiles\n");
+            fclose(file);
+            return -1;
+        }
+        result = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            unsigned char record[ECC_RECORD_SIZE];
+            if (fread(record, sizeof(record), 1, file) != 1) {
+                fprintf(stderr, "%s is truncated\n", ecc->path);
+                result = -1;
+                break;
+            }
+            EccProfile *profile = &ecc->profiles[i];
+            memcpy(profile->uuid, record, UUID_SIZE);
+            profile->uuid[UUID_SIZE - 1] = '\0';
+            const unsigned char *p = record + UUID_SIZE;
+            for (int bin = 0; bin < ECC_BINS; bin++) {
+                profile->exposure_ms[bin] = get_u64(p);
+                p += 8;
+                for (int counter = 0; counter < ECC_COUNTER_COUNT; counter++, p += 8)
+                    profile->errors[bin][counter] = get_u64(p);
+            }
+            ecc->profile_count++;
+        }
+    }
+    fclose(file);
+    return result;
+}
+
+/* Like save_baseline(), writes FILE.tmp without allocating and renames it. */
+static int save_ecc(Context *ctx) {
+    Ecc *ecc = &ctx->ecc;
+    char path[PATH_MAX];
+    clock_gettime(CLOCK_MONOTONIC, &ecc->saved);
+    if (snprintf(path, sizeof(path), "%s.tmp", ecc->path) >= (int)sizeof(path)) {
+        fprintf(stderr, "ECC profile path too long: %s\n", ecc->path);
+        return -1;
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    unsigned char header[24] = ECC_MAGIC;
+    put_u32(header + 8, ECC_VERSION);
+    put_u16(header + 12, ECC_BINS);
+    put_u16(header + 14, ECC_BIN_WIDTH);
+    put_u16(header + 16, ECC_COUNTER_COUNT);
+    put_u32(header + 20, ecc->profile_count);
+    int result = write_all(fd, header, sizeof(header));
+    for (unsigned int i = 0; result == 0 && i < ecc->profile_count; i++) {
+        const EccProfile *profile = &ecc->profiles[i];
+        unsigned char record[ECC_RECORD_SIZE];
+        memcpy(record, profile->uuid, UUID_SIZE);
+        unsigned char *p = record + UUID_SIZE;
+        for (int bin = 0; bin < ECC_BINS; bin++) {
+            put_u64(p, profile->exposure_ms[bin]);
+            p += 8;
+            for (int counter = 0; counter < ECC_COUNTER_COUNT; counter++, p += 8)
+                put_u64(p, profile->errors[bin][counter]);
+        }
+        result = write_all(fd, record, sizeof(record));
+    }
+    if (close(fd) < 0) result = -1;
+    if (result < 0 || rename(path, ecc->path) < 0) {
+        fprintf(stderr, "Failed to write %s: %s\n", ecc->path, strerror(errno));
+        unlink(path);
+        return -1;
+    }
+    return 0;
+}
+
+/* Reads the volatile ECC totals, which reset when the driver reloads, and
+ * the remapped rows (Ampere and later). Returns a bitmask of the counters
+ * read; the others are left as they were. */
+static int read_ecc_counters(Context *ctx, unsigned int index, nvmlDevice_t device,
+                             uint64_t *values, int *pending) {
+    static const nvmlMemoryErrorType_t types[] = {
+        NVML_MEMORY_ERROR_TYPE_CORRECTED, NVML_MEMORY_ERROR_TYPE_UNCORRECTED
+    };
+    int read = 0;
+    for (int counter = ECC_CORRECTED; counter <= ECC_UNCORRECTED; counter++) {
+        unsigned long long count = 0;
+        uint64_t start_ns = nvml_probe_start();
+        ctx->result = nvml.nvmlDeviceGetTotalEccErrors(device, types[counter], NVML_VOLATILE_ECC, &count);
+        nvml_probe_end("nvmlDeviceGetTotalEccErrors", index, ctx->result, start_ns);
+        if (NVML_SUCCESS != ctx->result) continue;
+        values[counter] = count;
+        read |= 1u << counter;
+    }
+
+    unsigned int correctable = 0, uncorrectable = 0, is_pending = 0, failed = 0;
+    uint64_t start_ns = nvml_probe_start();
+    ctx->result = nvml.nvmlDeviceGetRemappedRows ?
+        nvml.nvmlDeviceGetRemappedRows(device, &correctable, &uncorrectable, &is_pending, &failed) :
+        NVML_ERROR_FUNCTION_NOT_FOUND;
+    nvml_probe_end("nvmlDeviceGetRemappedRows", index, ctx->result, start_ns);
+    if (NVML_SUCCESS != ctx->result) return read;
+    values[ECC_REMAPPED_CORRECTABLE] = correctable;
+    values[ECC_REMAPPED_UNCORRECTABLE] = uncorrectable;
+    *pending = is_pending || failed;
+    return read | 1u << ECC_REMAPPED_CORRECTABLE | 1u << ECC_REMAPPED_UNCORRECTABLE;
+}
+
+/* Finds the ECC profile of the GPU in a row by UUID, or starts an empty one,
+ * and takes the counters the first check is compared with. */
+static int attach_ecc_row(Context *ctx, unsigned int row) {
+    Ecc *ecc = &ctx->ecc;
+    EccRow *state = &ecc->rows[row];
+    unsigned int index = ctx->indices[row];
+    char uuid[UUID_SIZE];
+    nvmlDevice_t device;
+    if ((get_device_handle(ctx, index, &device) < 0) ||
+        (get_gpu_uuid(ctx, index, device, uuid) < 0))
+        return -1;
+
+    memset(state, 0, sizeof(*state));
+    state->known = (unsigned int)read_ecc_counters(ctx, index, device, state->last, &state->pending);
+    state->supported = state->known != 0;
+    if (!state->supported) {
+        fprintf(stderr, "GPU %u reports no ECC or row remapping counters\n", index);
+        return 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &state->checked);
+
+    unsigned int i = 0;
+    while (i < ecc->profile_count && strcmp(ecc->profiles[i].uuid, uuid) != 0) i++;
+    if (i == ecc->profile_count) {
+        EccProfile *profiles = realloc(ecc->profiles, (i + 1) * sizeof(*profiles));
+        if (!profiles) {
+            fprintf(stderr, "Failed to allocate ECC profile for GPU %u\n", index);
+            return -1;
+        }
+        memset(&profiles[i], 0, sizeof(*profiles));
+        memcpy(profiles[i].uuid, uuid, sizeof(uuid));
+        ecc->profiles = profiles;
+        ecc->profile_count++;
+    }
+    state->profile = (int)i;
+    return 0;
+}
+
+static int init_ecc(Context *ctx) {
+    Ecc *ecc = &ctx->ecc;
+    if (!ecc->path) return 0;
+    if (load_ecc(ctx) < 0) return -1;
+
+    ecc->rows = calloc(ctx->row_capacity, sizeof(*ecc->rows));
+    if (!ecc->rows) {
+        fprintf(stderr, "Failed to allocate ECC state\n");
+        return -1;
+    }
+    for (unsigned int row = 0; row < ctx->device_count; row++) {
+        if (attach_ecc_row(ctx, row) < 0) return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ecc->saved);
+    signal(SIGUSR1, dump_signal_handler);
+    return 0;
+}
+
+static int handle_ecc_save(Context *ctx) {
+    struct timespec now;
+    if (!ctx->ecc.rows) return 0;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec - ctx->ecc.saved.tv_sec < ECC_SAVE_INTERVAL) return 0;
+    return save_ecc(ctx);
+}
+
+static unsigned int ecc_bin(uint32_t vram) {
+    unsigned int bin = vram / ECC_BIN_WIDTH;
+    return bin < ECC_BINS ? bin : ECC_BINS - 1;
+}
+
+/* With --ecc, counts the sample's VRAM temperature towards its bin, and every
+ * config.ecc_interval seconds reads the counters. The errors since the last
+ * check go to the bin of the hottest VRAM reading in between, since error
+ * rates climb with temperature. */
+static void update_ecc(Context *ctx, unsigned int row, GpuDevice *gpu) {
+    EccRow *state = &ctx->ecc.rows[row];
+    if (!state->supported) return;
+    EccProfile *profile = &ctx->ecc.profiles[state->profile];
+    if (state->reported) {
+        memset(state->window, 0, sizeof(state->window));
+        state->vram_min = state->vram_max = state->vram_samples = 0;
+        state->vram_sum = 0;
+        state->reported = 0;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint32_t vram = gpu->vram_temp;
+    if (vram) {
+        unsigned int bin = ecc_bin(vram);
+        profile->exposure_ms[bin] += sample_gap_ms(ctx, &state->sampled_ns, timespec_ns(&now));
+        state->window[bin]++;
+        if (!state->vram_samples || vram < state->vram_min) state->vram_min = vram;
+        if (vram > state->vram_max) state->vram_max = vram;
+        state->vram_sum += vram;
+        state->vram_samples++;
+    }
+
+    if (now.tv_sec - state->checked.tv_sec < (time_t)ctx->config.ecc_interval) return;
+    state->checked = now;
+
+    // A failed read keeps the previous counts, so the next successful one is
+    // compared with them and not with 0. The VRAM readings since the last
+    // check then carry over to the next one.
+    uint64_t values[ECC_COUNTER_COUNT];
+    unsigned int read = (unsigned int)read_ecc_counters(ctx, ctx->indices[row], gpu->device,
+        values, &state->pending);
+    if (!read) return;
+    unsigned int bin = ecc_bin(state->vram_max);
+    for (int counter = 0; counter < ECC_COUNTER_COUNT; counter++) {
+        unsigned int mask = 1u << counter;
+        state->delta[counter] = 0;
+        if (!(read & mask)) continue;
+        // A lower count means the driver was reloaded and started over.
+        uint64_t delta = values[counter] >= state->last[counter] ?
+            values[counter] - state->last[counter] : values[counter];
+        if (state->known & mask) {
+            state->delta[counter] = delta;
+            profile->errors[bin][counter] += delta;
+        }
+        state->last[counter] = values[counter];
+        state->known |= mask;
+    }
+    state->reported = 1;
+    gpu->ecc_checked = 1;
+}
+
+/* The counter deltas of a check and the VRAM temperatures they go with:
+ * their range, mean and samples per bin, as [lower bound, samples] pairs. */
+static void append_ecc(Context *ctx, unsigned int row) {
+    const EccRow *state = &ctx->ecc.rows[row];
+    buffer_append(ctx, ",\"ecc\":{");
+    for (int counter = 0; counter < ECC_COUNTER_COUNT; counter++) {
+        buffer_append(ctx, "%s\"%s\":%llu", counter ? "," : "", ECC_COUNTER_NAMES[counter],
+            (unsigned long long)state->delta[counter]);
+    }
+    buffer_append(ctx, ",\"pending\":%s", state->pending ? "true" : "false");
+    if (state->vram_samples) {
+        buffer_append(ctx, ",\"vram\":{\"min\":%u,\"mean\":%.1f,\"max\":%u,\"bins\":[",
+            state->vram_min, (double)state->vram_sum / state->vram_samples, state->vram_max);
+        for (int bin = 0, first = 1; bin < ECC_BINS; bin++) {
+            if (!state->window[bin]) continue;
+            buffer_append(ctx, "%s[%d,%u]", first ? "" : ",", bin * ECC_BIN_WIDTH, state->window[bin]);
+            first = 0;
+        }
+        buffer_append(ctx, "]}");
+    }
+    buffer_append(ctx, "}");
+}
+
+/* Writes the cumulative table of every GPU to stderr, like dump_histograms(). */
+static void dump_ecc(Context *ctx) {
+    if (!ctx->ecc.rows) return;
+
+    int first = 1;
+    fprintf(stderr, "{\"timestamp\":%ld,\"ecc\":[", (long)time(NULL));
+    for (unsigned int row = 0; row < ctx->device_count; row++) {
+        const EccRow *state = &ctx->ecc.rows[row];
+        if (!ctx->present[row] || !state->supported) continue;
+        const EccProfile *profile = &ctx->ecc.profiles[state->profile];
+        fprintf(stderr, "%s{\"gpu\":%u,\"uuid\":\"%s\",\"bins\":[", first ? "" : ",",
+            ctx->indices[row], profile->uuid);
+        first = 0;
+
+        int first_bin = 1;
+        for (int bin = 0; bin < ECC_BINS; bin++) {
+            if (!profile->exposure_ms[bin]) continue;
+            fprintf(stderr, "%s{\"vram\":%d,\"hours\":%.4g", first_bin ? "" : ",",
+                bin * ECC_BIN_WIDTH, profile->exposure_ms[bin] / 3.6e6);
+            for (int counter = 0; counter < ECC_COUNTER_COUNT; counter++) {
+                fprintf(stderr, ",\"%s\":%llu", ECC_COUNTER_NAMES[counter],
+                    (unsigned long long)profile->errors[bin][counter]);
+            }
+            fprintf(stderr, "}");
+            first_bin = 0;
+        }
+        fprintf(stderr, "]}");
+    }
+    fprintf(stderr, "]}\n");
+    fflush(stderr);
+}
+
+static void handle_dump_request(Context *ctx) {
+    if (!dump_requested) return;
+    dump_requested = 0;
+    dump_histograms(ctx);
+    dump_ecc(ctx);
+}
+
+static FILE *open_output(const char *path) {
+    FILE *output = fopen(path, "a");
+    if (!output) fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+    return output;
+}
+
+static void close_output_sink(OutputQueue *queue) {
+    if (queue->own_fd) close(queue->fd);
+    queue->own_fd = 0;
+}
+
+/* Sets up the fd the queue is written through. Regular files are written
+ * directly. Pipes and terminals get a file description of their own through
+ * /proc/self/fd, opened O_NONBLOCK, so the flag does not leak to the shell
+ * that shares stdout. Sockets cannot be reopened that way and are written
+ * with MSG_DONTWAIT instead. */
+static void open_output_sink(OutputQueue *queue, FILE *output) {
+    close_output_sink(queue);
+    struct stat st;
+    queue->fd = fileno(output);
+    int known = fstat(queue->fd, &st) == 0;
+    queue->regular = known && S_ISREG(st.st_mode);
+    queue->socket = known && S_ISSOCK(st.st_mode);
+    if (queue->regular || queue->socket) return;
+
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", queue->fd);
+    int fd = open(path, O_WRONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+    if (fd >= 0) {
+        queue->fd = fd;
+        queue->own_fd = 1;
+    }
+}
+
+static void compact_output_queue(OutputQueue *queue) {
+    size_t begin = queue->start - queue->sent;
+    if (begin == 0) return;
+    memmove(queue->data, queue->data + begin, queue->end - begin);
+    queue->start -= begin;
+    queue->end -= begin;
+}
+
+/* Position of the oldest record that may be dropped, i.e. neither pinned
+ * nor partly written, or the record count if there is none. */
+static unsigned int oldest_droppable(const OutputQueue *queue) {
+    for (unsigned int i = queue->sent > 0; i < queue->count; i++) {
+        if (!queue->pinned[(queue->first + i) % queue->max_records]) return i;
+    }
+    return queue->count;
+}
+
+/* Removes the record at position i, counting from the oldest. */
+static void drop_queued(OutputQueue *queue, unsigned int i) {
+    size_t offset = queue->start - queue->sent;
+    for (unsigned int k = 0; k < i; k++)
+        offset += queue->lengths[(queue->first + k) % queue->max_records];
+    size_t length = queue->lengths[(queue->first + i) % queue->max_records];
+    memmove(queue->data + offset, queue->data + offset + length, queue->end - offset - length);
+    queue->end -= length;
+    for (unsigned int k = i; k + 1 < queue->count; k++) {
+        queue->lengths[(queue->first + k) % queue->max_records] =
+            queue->lengths[(queue->first + k + 1) % queue->max_records];
+        queue->pinned[(queue->first + k) % queue->max_records] =
+            queue->pinned[(queue->first + k + 1) % queue->max_records];
+    }
+    queue->count--;
+    queue->dropped++;
+}
+
+/* Sizes the queue for max_records records of the current output buffer
+ * size, dropping the oldest records that no longer fit. Pinned records are
+ * kept, and the queue stays large enough for them until they are written. */
+static int resize_output_queue(Context *ctx, unsigned int max_records) {
+    OutputQueue *queue = &ctx->queue;
+    unsigned int i;
+    while (queue->count > max_records && (i = oldest_droppable(queue)) < queue->count)
+        drop_queued(queue, i);
+    if (queue->count > max_records) max_records = queue->count;
+    compact_output_queue(queue);
+
+    size_t *lengths = malloc(max_records * sizeof(*lengths));
+    unsigned char *pinned = lengths ? malloc(max_records) : NULL;
+    char *data = pinned ? realloc(queue->data, (size_t)max_records * ctx->buffer_size) : NULL;
+    if (!data) {
+        free(lengths);
+        free(pinned);
+        fprintf(stderr, "Failed to allocate output queue\n");
+        return -1;
+    }
+    for (unsigned int k = 0; k < queue->count; k++) {
+        lengths[k] = queue->lengths[(queue->first + k) % queue->max_records];
+        pinned[k] = queue->pinned[(queue->first + k) % queue->max_records];
+    }
+    free(queue->lengths);
+    free(queue->pinned);
+    queue->lengths = lengths;
+    queue->pinned = pinned;
+    queue->data = data;
+    queue->capacity = (size_t)max_records * ctx->buffer_size;
+    queue->max_records = max_records;
+    queue->first = 0;
+    return 0;
+}
+
+static void advance_output_queue(OutputQueue *queue, size_t written) {
+    queue->start += written;
+    queue->sent += written;
+    while (queue->count > 0 && queue->sent >= queue->lengths[queue->first]) {
+        queue->sent -= queue->lengths[queue->first];
+        queue->first = (queue->first + 1) % queue->max_records;
+        queue->count--;
+    }
+    if (queue->count == 0) {
+        queue->start = queue->end = 0;
+        queue->flushing = 0;
+    }
+}
+
+/* Hands whole queued records to the compression thread, as many as fit, so
+ * that a block never ends in the middle of a line. */
+static int drain_compressed(Context *ctx, int wait) {
+    OutputQueue *queue = &ctx->queue;
+    Compressor *compressor = &ctx->compressor;
+    pthread_mutex_lock(&compressor->lock);
+    while (queue->count > 0 && !compressor->error) {
+        size_t room = COMPRESS_INPUT_SIZE - compressor->input_size;
+        size_t size = 0;
+        for (unsigned int k = 0; k < queue->count; k++) {
+            size_t length = queue->lengths[(queue->first + k) % queue->max_records] -
+                (k == 0 ? queue->sent : 0);
+            if (size + length > room) break;
+            size += length;
+        }
+        // Only a record larger than the whole input buffer gets split.
+        if (size == 0 && compressor->input_size == 0) {
+            size = queue->end - queue->start;
+            if (size > room) size = room;
+        }
+        if (size == 0) {
+            if (!wait) break;
+            pthread_cond_wait(&compressor->room, &compressor->lock);
+            continue;
+        }
+
+        int was_empty = compressor->input_size == 0;
+        memcpy(compressor->input + compressor->input_size, queue->data + queue->start, size);
+        compressor->input_size += size;
+        if (was_empty || compressor->input_size >= COMPRESS_BLOCK_SIZE)
+            pthread_cond_signal(&compressor->wake);
+        advance_output_queue(queue, size);
+    }
+    int error = compressor->error;
+    pthread_mutex_unlock(&compressor->lock);
+    if (error) {
+        fprintf(stderr, "Failed to write %s: %s\n", ctx->config.output_path, strerror(error));
+        return -1;
+    }
+    return 0;
+}
+
+/* Writes queued records until the sink would block or, with wait, until the
+ * queue is empty. Sinks other than regular files are written without
+ * blocking, see open_output_sink(). Without /proc, a pipe or terminal is
+ * written at most PIPE_BUF bytes at a time once poll() reports room, which
+ * never blocks on a pipe but may on a terminal. */
+static int drain_output(Context *ctx, int wait) {
+    if (ctx->compressor.enabled) return drain_compressed(ctx, wait);
+
+    OutputQueue *queue = &ctx->queue;
+    int fd = queue->fd;
+    while (queue->count > 0) {
+        size_t size = queue->end - queue->start;
+        if (!queue->regular) {
+            struct pollfd pollfd = {.fd = fd, .events = POLLOUT};
+            int ready = poll(&pollfd, 1, wait ? -1 : 0);
+            // A signal ends the wait, e.g. CTRL+C while the reader is stalled.
+            if (ready == 0 || (ready < 0 && errno == EINTR)) return 0;
+            if (ready < 0) {
+                fprintf(stderr, "Failed to poll output: %s\n", strerror(errno));
+                return -1;
+            }
+            if (!queue->own_fd && !queue->socket && size > PIPE_BUF) size = PIPE_BUF;
+        }
+        ssize_t written = queue->socket ?
+            send(fd, queue->data + queue->start, size, MSG_DONTWAIT) :
+            write(fd, queue->data + queue->start, size);
+        if (written < 0 && errno == EINTR) continue;
+        // poll() reported room but less than size: wait for more, or retry later.
+        if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (wait) continue;
+            return 0;
+        }
+        if (written < 0) {
+            fprintf(stderr, "Failed to write output: %s\n", strerror(errno));
+            return -1;
+        }
+        advance_output_queue(queue, (size_t)written);
+    }
+    return 0;
+}
+
+/* Starts writing the queue out; --eco waits until it holds a batch. */
+static int flush_output(Context *ctx) {
+    OutputQueue *queue = &ctx->queue;
+    unsigned int batch = queue->max_records < ECO_FLUSH_RECORDS ?
+        queue->max_records : ECO_FLUSH_RECORDS;
+    if (queue->count > 0 && (!ctx->eco.enabled || queue->count >= batch)) queue->flushing = 1;
+    return queue->flushing ? drain_output(ctx, 0) : 0;
+}
+
+/* Queues one record, applying the policy when the queue is full. A record
+ * that is partly written is never dropped, so the stream stays line-aligned;
+ * block falls back to drop-oldest if a signal interrupts the wait. A pinned
+ * record is never dropped either: if nothing else can make room for one, it
+ * waits for the reader. */
+static int enqueue_record(Context *ctx, const char *record, size_t length, int pinned) {
+    OutputQueue *queue = &ctx->queue;
+    if (queue->count == queue->max_records && ctx->config.policy == POLICY_BLOCK &&
+        drain_output(ctx, 1) < 0)
+        return -1;
+    if (queue->count == queue->max_records) {
+        unsigned int i = oldest_droppable(queue);
+        if (!pinned && (ctx->config.policy == POLICY_DROP_NEWEST || i == queue->count)) {
+            queue->dropped++;
+            return 0;
+        }
+        if (i < queue->count) {
+            do {
+                drop_queued(queue, i);
+            } while (ctx->config.policy == POLICY_LATEST &&
+                     (i = oldest_droppable(queue)) < queue->count);
+        }
+        while (queue->count == queue->max_records && running) {
+            if (drain_output(ctx, 1) < 0) return -1;
+        }
+        if (queue->count == queue->max_records) {
+            queue->dropped++;
+            return 0;
+        }
+    }
+
+    if (queue->end + length > queue->capacity) compact_output_queue(queue);
+    memcpy(queue->data + queue->end, record, length);
+    queue->end += length;
+    queue->lengths[(queue->first + queue->count) % queue->max_records] = length;
+    queue->pinned[(queue->first + queue->count) % queue->max_records] = (unsigned char)pinned;
+    queue->count++;
+    return 0;
+}
+
+static int init_output(Context *ctx) {
+    if (ctx->config.output_path[0]) {
+        ctx->output = open_output(ctx->config.output_path);
+        if (!ctx->output) return -1;
+    }
+    setvbuf(ctx->output, output_stream_buffer, isatty(fileno(ctx->output)) ? _IOLBF : _IOFBF,
+        sizeof(output_stream_buffer));
+    if (ctx->output_format != FORMAT_JSON) return 0;
+    open_output_sink(&ctx->queue, ctx->output);
+    if (resize_output_queue(ctx, ctx->config.queue_records) < 0) return -1;
+    return ctx->config.compress != COMPRESS_NONE ? start_compressor(ctx) : 0;
+}
+
+static int parse_config_uint(const char *value, unsigned long max, unsigned long *out) {
+    char *end;
+    errno = 0;
+    unsigned long number = strtoul(value, &end, 10);
+    if (!isdigit((unsigned char)*value) || *end || errno || number > max) return -1;
+    *out = number;
+    return 0;
+}
+
+static int parse_config_fields(const char *value, unsigned int *fields) {
+    char list[CONFIG_LINE_SIZE];
+    char *save;
+    unsigned int mask = 0;
+
+    snprintf(list, sizeof(list), "%s", value);
+    for (char *name = strtok_r(list, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+        name = trim(name);
+        int field = 0;
+        while (field < FIELD_COUNT && strcmp(name, FIELD_NAMES[field]) != 0) field++;
+        if (field == FIELD_COUNT) return -1;
+        mask |= 1u << field;
+    }
+    if (!mask) return -1;
+    *fields = mask;
+    return 0;
+}
+
+static int set_config_value(Config *config, const char *key, const char *value) {
+    unsigned long number;
+
+    if (strcmp(key, "interval_ms") == 0) {
+        if (parse_config_uint(value, 3600000, &number) < 0 || number == 0) return -1;
+        config->interval_ms = (unsigned int)number;
+        return 0;
+    }
+    if (strcmp(key, "ecc_interval") == 0) {
+        if (parse_config_uint(value, 86400, &number) < 0 || number == 0) return -1;
+        config->ecc_interval = (unsigned int)number;
+        return 0;
+    }
+    if (strcmp(key, "fields") == 0) return parse_config_fields(value, &config->fields);
+    if (strcmp(key, "oversample") == 0) {
+        if (parse_config_uint(value, OVERSAMPLE_MAX, &number) < 0 || number == 0) return -1;
+        config->oversample = (unsigned int)number;
+        return 0;
+    }
+    if (strcmp(key, "filter") == 0) {
+        for (Filter filter = FILTER_MEDIAN; filter <= FILTER_TRIMMED; filter++) {
+            if (strcmp(value, FILTER_NAMES[filter]) != 0) continue;
+            config->filter = filter;
+            return 0;
+        }
+        return -1;
+    }
+    if (strcmp(key, "queue") == 0) {
+        if (parse_config_uint(value, QUEUE_MAX_RECORDS, &number) < 0 || number == 0) return -1;
+        config->queue_records = (unsigned int)number;
+        return 0;
+    }
+    if (strcmp(key, "policy") == 0) {
+        for (Policy policy = POLICY_DROP_OLDEST; policy <= POLICY_BLOCK; policy++) {
+            if (strcmp(value, POLICY_NAMES[policy]) != 0) continue;
+            config->policy = policy;
+            return 0;
+        }
+        return -1;
+    }
+    if (strcmp(key, "regression") == 0) {
+        if (parse_config_uint(value, 0x7e, &number) < 0 || number == 0) return -1;
+        config->regression = (uint32_t)number;
+        return 0;
+    }
+    if (strcmp(key, "compress") == 0) {
+        for (Compression compress = COMPRESS_NONE; compress <= COMPRESS_GZIP; compress++) {
+            if (strcmp(value, COMPRESSION_NAMES[compress]) != 0) continue;
+            config->compress = compress;
+            return 0;
+        }
+        return -1;
+    }
+    if (strcmp(key, "output") == 0 || strcmp(key, "raw") == 0) {
+        char *path = key[0] == 'o' ? config->output_path : config->raw_path;
+        if (strlen(value) >= PATH_MAX) return -1;
+        strcpy(path, strcmp(value, "-") == 0 ? "" : value);
+        return 0;
+    }
+    for (int field = 0; field < FIELD_COUNT; field++) {
+        size_t len = strlen(FIELD_NAMES[field]);
+        if (strncmp(key, FIELD_NAMES[field], len) != 0 || key[len] != '_') continue;
+        uint32_t *threshold = strcmp(key + len + 1, "warn") == 0 ? &config->warn[field]
+            : strcmp(key + len + 1, "danger") == 0 ? &config->danger[field] : NULL;
+        if (!threshold || parse_config_uint(value, 0x7e, &number) < 0) return -1;
+        *threshold = (uint32_t)number;
+        return 0;
+    }
+    return -1;
+}
+
+/* Sets a key from the command line in ctx->base and remembers it for
+ * load_config(). A repeated flag replaces the earlier value. */
+static int set_flag(Context *ctx, const char *key, const char *value) {
+    if (set_config_value(&ctx->base, key, value) < 0) return -1;
+    unsigned int i = 0;
+    while (i < ctx->flag_count && strcmp(ctx->flags[i].key, key) != 0) i++;
+    if (i == ctx->flag_count) ctx->flag_count++;
+    ctx->flags[i] = (Setting){key, value};
+    return 0;
+}
+
+/* Reads `key = value` lines on top of ctx->base, so settings removed from
+ * the file fall back to the command line and the defaults, then applies
+ * the command line flags again so they win over the file. */
+static int load_config(const Context *ctx, Config *out) {
+    const char *path = ctx->config_path;
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    Config config = ctx->base;
+    char line[CONFIG_LINE_SIZE];
+    int line_number = 0;
+    int result = 0;
+    while (result == 0 && fgets(line, sizeof(line), file)) {
+        line_number++;
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+        char *key = trim(line);
+        if (!*key) continue;
+
+        char *equals = strchr(key, '=');
+        if (!equals) {
+            fprintf(stderr, "%s:%d: Expected key = value\n", path, line_number);
+            result = -1;
+            break;
+        }
+        *equals = '\0';
+        key = trim(key);
+        char *value = trim(equals + 1);
+        if (set_config_value(&config, key, value) < 0) {
+            fprintf(stderr, "%s:%d: Invalid setting: %s = %s\n", path, line_number, key, value);
+            result = -1;
+        }
+    }
+    if (result == 0 && ferror(file)) {
+        fprintf(stderr, "Failed to read %s: %s\n", path, strerror(errno));
+        result = -1;
+    }
+    fclose(file);
+
+    // Flags were validated when they were parsed.
+    for (unsigned int i = 0; result == 0 && i < ctx->flag_count; i++)
+        set_config_value(&config, ctx->flags[i].key, ctx->flags[i].value);
+    if (result == 0) *out = config;
+    return result;
+}
+
+/* Applies a reloaded configuration. Only the sinks whose path or
+ * compression changed are reopened; if one fails to open, the old one is
+ * kept. Records queued for the old output are written to it before
+ * switching. */
+static void apply_config(Context *ctx, const Config *next) {
+    Config *config = &ctx->config;
+    Config applied = *next;
+    char changed[128] = "";
+
+    if (applied.compress != COMPRESS_NONE && (!applied.output_path[0] || !ctx->queue.data)) {
+        fprintf(stderr, "Compression needs --json and an output file, ignoring it\n");
+        applied.compress = COMPRESS_NONE;
+    }
+    if (strcmp(applied.output_path, config->output_path) != 0 ||
+        applied.compress != config->compress) {
+        FILE *output = applied.output_path[0] ? open_output(applied.output_path) : stdout;
+        if (output) {
+            drain_output(ctx, 1);
+            stop_compressor(ctx);
+            if (ctx->output != stdout) fclose(ctx->output);
+            ctx->output = output;
+            open_output_sink(&ctx->queue, output);
+            if (applied.compress != COMPRESS_NONE && start_compressor(ctx) < 0)
+                applied.compress = COMPRESS_NONE;
+            strcat(changed, " output");
+        } else {
+            strcpy(applied.output_path, config->output_path);
+            applied.compress = config->compress;
+        }
+    }
+
+    if (ctx->backend == BACKEND_HWMON && next->raw_path[0]) {
+        fprintf(stderr, "--raw needs the nvidia backend, ignoring it\n");
+        strcpy(applied.raw_path, config->raw_path);
+    } else if (strcmp(next->raw_path, config->raw_path) != 0) {
+        FILE *raw = next->raw_path[0] ? open_raw_capture(ctx, next->raw_path) : NULL;
+        if (raw || !next->raw_path[0]) {
+            if (ctx->raw && fclose(ctx->raw) != 0)
+                fprintf(stderr, "Failed to write %s: %s\n", config->raw_path, strerror(errno));
+            ctx->raw = raw;
+            strcat(changed, " raw");
+        } else {
+            strcpy(applied.raw_path, config->raw_path);
+        }
+    }
+
+    if (ctx->queue.data && applied.queue_records != config->queue_records &&
+        resize_output_queue(ctx, applied.queue_records) < 0)
+        applied.queue_records = config->queue_records;
+
+    if (applied.interval_ms != config->interval_ms) strcat(changed, " interval_ms");
+    if (applied.ecc_interval != config->ecc_interval) strcat(changed, " ecc_interval");
+    if (applied.fields != config->fields) strcat(changed, " fields");
+    if (applied.oversample != config->oversample || applied.filter != config->filter)
+        strcat(changed, " oversample");
+    if (applied.queue_records != config->queue_records || applied.policy != config->policy)
+        strcat(changed, " queue");
+    if (memcmp(applied.warn, config->warn, sizeof(applied.warn)) != 0 ||
+        memcmp(applied.danger, config->danger, sizeof(applied.danger)) != 0 ||
+        applied.regression != config->regression)
+        strcat(changed, " thresholds");
+
+    *config = applied;
+    if (ctx->eco.enabled) set_timer_slack(ctx);
+    if (ctx->history) update_spark_width(ctx);
+    // The table redraws in place and has no room for it.
+    if (ctx->output_format == FORMAT_JSON)
+        fprintf(stderr, "Reloaded %s:%s\n", ctx->config_path, changed[0] ? changed : " no changes");
+}
+
+static void handle_reload_request(Context *ctx) {
+    if (!reload_requested) return;
+    reload_requested = 0;
+
+    Config next;
+    if (load_config(ctx, &next) < 0) {
+        fprintf(stderr, "Keeping the current configuration\n");
+        return;
+    }
+    apply_config(ctx, &next);
+}
+
+static int get_bus_id(Context *ctx, unsigned int index, char *bus_id) {
+    if (ctx->backend == BACKEND_HWMON) {
+        memcpy(bus_id, ctx->hwmon[index].bus_id, BUS_ID_SIZE);
+        return 0;
+    }
+
+    nvmlDevice_t device;
+    nvmlPciInfo_t pci_info;
+    if ((get_device_handle(ctx, index, &device) < 0) ||
+        (get_device_pci_info(ctx, index, device, &pci_info) < 0))
+        return -1;
+    size_t len = strnlen(pci_info.busIdLegacy, BUS_ID_SIZE - 1);
+    memcpy(bus_id, pci_info.busIdLegacy, len);
+    bus_id[len] = '\0';
+    return 0;
+}
+
+/* Rows are identified by bus ID, which survives resets and re-enumeration.
+ * A row stays in place while its GPU is lost and keeps its history. */
+static int init_topology(Context *ctx) {
+    unsigned int count = ctx->device_count;
+    ctx->row_capacity = count;
+    ctx->bus_ids = calloc(count, sizeof(*ctx->bus_ids));
+    ctx->present = malloc(count);
+    ctx->changes = calloc(count, 1);
+    ctx->previous_indices = calloc(count, sizeof(*ctx->previous_indices));
+    if (!ctx->bus_ids || !ctx->present || !ctx->changes || !ctx->previous_indices) {
+        fprintf(stderr, "Failed to allocate GPU topology\n");
+        return -1;
+    }
+    memset(ctx->present, 1, count);
+
+    for (unsigned int row = 0; row < count; row++) {
+        if (get_bus_id(ctx, ctx->indices[row], ctx->bus_ids[row]) < 0) return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ctx->topology_checked);
+    return 0;
+}
+
+/* Grows a per-row array from old_count to count elements, zeroing the new
+ * ones. The array is left untouched on failure. */
+static int grow_rows(void **array, size_t old_count, size_t count, size_t size) {
+    char *grown = realloc(*array, count * size);
+    if (!grown) return -1;
+    memset(grown + old_count * size, 0, (count - old_count) * size);
+    *array = grown;
+    return 0;
+}
+
+/* Appends a row for a GPU that appeared after startup. */
+static int add_row(Context *ctx, unsigned int index, const char *bus_id) {
+    if (ctx->device_count == ctx->row_capacity) {
+        size_t old = ctx->row_capacity, capacity = old * 2;
+        if (grow_rows((void **)&ctx->indices, old, capacity, sizeof(*ctx->indices)) < 0 ||
+            grow_rows((void **)&ctx->bus_ids, old, capacity, sizeof(*ctx->bus_ids)) < 0 ||
+            grow_rows((void **)&ctx->present, old, capacity, 1) < 0 ||
+            grow_rows((void **)&ctx->changes, old, capacity, 1) < 0 ||
+            grow_rows((void **)&ctx->previous_indices, old, capacity,
+                sizeof(*ctx->previous_indices)) < 0 ||
+            (ctx->history && grow_rows((void **)&ctx->history, old, capacity,
+                sizeof(*ctx->history)) < 0) ||
+            (ctx->histograms && grow_rows((void **)&ctx->histograms, old * ACCESS_COUNT,
+                capacity * ACCESS_COUNT, sizeof(Histogram)) < 0) ||
+            (ctx->baseline.rows && grow_rows((void **)&ctx->baseline.rows, old, capacity,
+                sizeof(*ctx->baseline.rows)) < 0) ||
+            (ctx->links && grow_rows((void **)&ctx->links, old, capacity,
+                sizeof(*ctx->links)) < 0) ||
+            (ctx->ecc.rows && grow_rows((void **)&ctx->ecc.rows, old, capacity,
+                sizeof(*ctx->ecc.rows)) < 0) ||
+            (ctx->quality && grow_rows((void **)&ctx->quality, old, capacity,
+                sizeof(*ctx->quality)) < 0)) {
+            fprintf(stderr, "Failed to allocate a row for GPU %u\n", index);
+            return -1;
+        }
+        ctx->row_capacity = capacity;
+    }
+
+    unsigned int row = ctx->device_count++;
+    ctx->indices[row] = index;
+    memcpy(ctx->bus_ids[row], bus_id, BUS_ID_SIZE);
+    ctx->present[row] = 1;
+    ctx->changes[row] = CHANGE_ADDED;
+    if ((init_output_buffer(ctx) < 0) ||
+        (ctx->baseline.rows && attach_baseline_row(ctx, row) < 0) ||
+        (ctx->ecc.rows && attach_ecc_row(ctx, row) < 0))
+        return -1;
+    return ctx->queue.data ? resize_output_queue(ctx, ctx->queue.max_records) : 0;
+}
+
+static int find_row(Context *ctx, unsigned int index) {
+    for (unsigned int row = 0; row < ctx->device_count; row++) {
+        if (ctx->present[row] && ctx->indices[row] == index) return (int)row;
+    }
+    return -1;
+}
+
+/* Looks up every row by bus ID, then, without a --gpus selection, adds the
+ * GPUs no row knows about. Returns the number of changed rows. */
+static int check_nvml_topology(Context *ctx) {
+    int changed = 0;
+    unsigned int present_count = 0;
+
+    for (unsigned int row = 0; row < ctx->device_count; row++) {
+        nvmlDevice_t device;
+        unsigned int index = 0;
+        uint64_t start_ns = nvml_probe_start();
+        ctx->result = nvml.nvmlDeviceGetHandleByPciBusId(ctx->bus_ids[row], &device);
+        nvml_probe_end("nvmlDeviceGetHandleByPciBusId", ctx->indices[row], ctx->result, start_ns);
+        if (NVML_SUCCESS == ctx->result) {
+            start_ns = nvml_probe_start();
+            ctx->result = nvml.nvmlDeviceGetIndex(device, &index);
+            nvml_probe_end("nvmlDeviceGetIndex", ctx->indices[row], ctx->result, start_ns);
+        }
+
+        Change change = CHANGE_NONE;
+        if (NVML_SUCCESS == ctx->result) {
+            if (!ctx->present[row]) {
+                change = CHANGE_ADDED;
+            } else if (index != ctx->indices[row]) {
+                change = CHANGE_MOVED;
+                ctx->previous_indices[row] = ctx->indices[row];
+            }
+            ctx->present[row] = 1;
+            ctx->indices[row] = index;
+            present_count++;
+        } else if (NVML_ERROR_NOT_FOUND == ctx->result || NVML_ERROR_GPU_IS_LOST == ctx->result) {
+            if (ctx->present[row]) change = CHANGE_REMOVED;
+            ctx->present[row] = 0;
+        } else {
+            fprintf(stderr, "Failed to look up GPU %s: %s\n",
+              ctx->bus_ids[row], nvml.nvmlErrorString(ctx->result));
+            return -1;
+        }
+        if (change) {
+            ctx->changes[row] = change;
+            changed++;
+        }
+    }
+    if (!ctx->all_gpus) return changed;
+
+    unsigned int count;
+    uint64_t start_ns = nvml_probe_start();
+    ctx->result = nvml.nvmlDeviceGetCount(&count);
+    nvml_probe_end("nvmlDeviceGetCount", UINT32_MAX, ctx->result, start_ns);
+    if (NVML_SUCCESS != ctx->result) {
+        fprintf(stderr, "Failed to get device count: %s\n",
+          nvml.nvmlErrorString(ctx->result));
+        return -1;
+    }
+    for (unsigned int index = 0; index < count && present_count < count; index++) {
+        char bus_id[BUS_ID_SIZE];
+        if (find_row(ctx, index) >= 0) continue;
+        if ((get_bus_id(ctx, index, bus_id) < 0) ||
+            (add_row(ctx, index, bus_id) < 0))
+            return -1;
+        present_count++;
+        changed++;
+    }
+    return changed;
+}
+
+/* hwmon nodes come and go with their PCI device; a node that reappears may
+ * have a new hwmonN name, so rows are matched to nodes by bus ID. */
+static int check_hwmon_topology(Context *ctx) {
+    DIR *dir = ctx->hwmon_dir;
+    rewinddir(dir);
+
+    int changed = 0;
+    for (unsigned int i = 0; i < ctx->hwmon_count; i++) ctx->hwmon[i].seen = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        if (strncmp(entry->d_name, "hwmon", 5) != 0) continue;
+        int hwmon_fd = openat(dirfd(dir), entry->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (hwmon_fd < 0) continue;
+
+        char bus_id[BUS_ID_SIZE];
+        if (!read_hwmon_bus_id(hwmon_fd, bus_id)) {
+            close(hwmon_fd);
+            continue;
+        }
+        unsigned int i = 0;
+        while (i < ctx->hwmon_count && strcmp(ctx->hwmon[i].bus_id, bus_id) != 0) i++;
+        if (i < ctx->hwmon_count) {
+            HwmonDevice *device = &ctx->hwmon[i];
+            device->seen = 1;
+            int row = -1;
+            for (unsigned int r = 0; r < ctx->device_count; r++) {
+                if (ctx->indices[r] == i) row = (int)r;
+            }
+            if (row >= 0 && !ctx->present[row] && open_hwmon_device(hwmon_fd, device)) {
+                ctx->present[row] = 1;
+                ctx->changes[row] = CHANGE_ADDED;
+                changed++;
+            }
+        } else if (ctx->all_gpus) {
+            if (grow_hwmon(ctx) < 0) {
+                close(hwmon_fd);
+                return -1;
+            }
+            if (open_hwmon_device(hwmon_fd, &ctx->hwmon[i])) {
+                ctx->hwmon[i].seen = 1;
+                ctx->hwmon_count++;
+                if (add_row(ctx, i, bus_id) < 0) {
+                    close(hwmon_fd);
+                    return -1;
+                }
+                changed++;
+            }
+        }
+        close(hwmon_fd);
+    }
+
+    for (unsigned int row = 0; row < ctx->device_count; row++) {
+        HwmonDevice *device = &ctx->hwmon[ctx->indices[row]];
+        if (!ctx->present[row] || device->seen) continue;
+        close_hwmon_device(device);
+        ctx->present[row] = 0;
+        ctx->changes[row] = CHANGE_REMOVED;
+        changed++;
+    }
+    return changed;
+}
+
+/* Queues the changes found since the last topology record. A check during
+ * a snapshot only marks them, as the output buffer holds the sample record. */
+static int emit_topology_record(Context *ctx) {
+    if (!ctx->topology_pending) return 0;
+    ctx->topology_pending = 0;
+
+    unsigned int present_count = 0;
+    ctx->buffer_pos = 0;
+    buffer_append(ctx, "{\"timestamp\":%ld,\"topology\":[", (long)time(NULL));
+    for (unsigned int row = 0, first = 1; row < ctx->device_count; row++) {
+        present_count += ctx->present[row];
+        if (!ctx->changes[row]) continue;
+        buffer_append(ctx, "%s{\"change\":\"%s\",\"index\":%u,\"bus_id\":\"%s\"",
+            first ? "" : ",", CHANGE_NAMES[ctx->changes[row]], ctx->indices[row],
+            ctx->bus_ids[row]);
+        if (ctx->changes[row] == CHANGE_MOVED)
+            buffer_append(ctx, ",\"previous_index\":%u", ctx->previous_indices[row]);
+        buffer_append(ctx, "}");
+        first = 0;
+    }
+    buffer_append(ctx, "],\"gpus\":%u}\n", present_count);
+    memset(ctx->changes, 0, ctx->device_count);
+    return enqueue_record(ctx, ctx->output_buffer, ctx->buffer_pos, 1);
+}
+
+/* Re-enumerates GPUs incrementally: known rows are looked up by bus ID
+ * instead of tearing down and reinitializing the backend. */
+static int check_topology(Context *ctx) {
+    clock_gettime(CLOCK_MONOTONIC, &ctx->topology_checked);
+    if (!ctx->topology_pending) memset(ctx->changes, 0, ctx->device_count);
+
+    int changed = ctx->backend == BACKEND_HWMON ?
+        check_hwmon_topology(ctx) : check_nvml_topology(ctx);
+    if (changed <= 0) return changed;
+
+    // A GPU that came back may sit behind a new PCI device entry. Removals
+    // and moves keep the entries, and skip the rescan and its allocations.
+    int added = 0;
+    for (unsigned int row = 0; row < ctx->device_count; row++)
+        added |= ctx->changes[row] == CHANGE_ADDED;
+    if (ctx->backend == BACKEND_NVIDIA && added) {
+        pci_cleanup(ctx->pacc);
+        ctx->pacc = NULL;
+        if (init_pci(ctx) < 0) return -1;
+    }
+    if (ctx->history) update_spark_width(ctx);
+    if (ctx->output_format == FORMAT_JSON) ctx->topology_pending = 1;
+    return changed;
+}
+
+static int handle_topology_check(Context *ctx) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec - ctx->topology_checked.tv_sec < TOPOLOGY_INTERVAL) return 0;
+    if (check_topology(ctx) < 0) return -1;
+    if (!ctx->topology_pending) return 0;
+    return emit_topology_record(ctx) < 0 ? -1 : flush_output(ctx);
+}
+
+/* A failed sample may mean the GPU was reset or fell off the bus. Returns 0
+ * if re-enumeration explains the failure and the row should be skipped. */
+static int recover_gpu(Context *ctx, unsigned int row) {
+    unsigned int index = ctx->indices[row];
+    if (check_topology(ctx) < 0) return -1;
+    return (!ctx->present[row] || ctx->indices[row] != index) ? 0 : -1;
+}
+
+static int get_gpu_temps(Context *ctx, unsigned int row, GpuDevice *gpu) {
+    PROBE1(sample_start, ctx->indices[row]);
+    int result = read_gpu_temps(ctx, row, gpu);
+    if (result == 0 && ctx->backend == BACKEND_NVIDIA && (ctx->baseline.rows || ctx->links))
+        read_gpu_load(ctx, row, gpu);
+    if (result == 0) check_quality(ctx, row, gpu);
+    if (result == 0 && ctx->links) gpu->link_read = read_pcie_link(ctx, row, gpu) == 0;
+    if (result == 0 && ctx->ecc.rows) update_ecc(ctx, row, gpu);
+    PROBE5(sample_end, ctx->indices[row], result, gpu->gpu_temp, gpu->junction_temp, gpu->vram_temp);
+    // Rows added after the capture was opened are not in its header.
+    if (ctx->raw && gpu->registers_read && row < ctx->raw_rows) write_raw_record(ctx, row, gpu);
+    return result;
+}
+
+static int monitor_temperatures_table(Context *ctx) {
+    static int refresh_counter = 0;
+    int valid_readings = 0;
+    struct timespec snapshot_start;
+    stage_now(ctx, &snapshot_start);
+
+    if (resize_requested) {
+        resize_requested = 0;
+        update_spark_width(ctx);
+    }
+    int sparklines = ctx->history && ctx->spark_width > 0;
+    int redraw = ctx->spark_redraw;
+
+    ctx->buffer_pos = 0;
+    refresh_counter = refresh_counter == 0 ? 1 : 0;
+    buffer_append(ctx, "\n%s", refresh_counter == 0 ? "* " : "  ");
+    if (ctx->spark_redraw) buffer_append(ctx, "\033[J");
+    for (int field = 0; field < FIELD_COUNT; field++) {
+        if (ctx->config.fields & (1u << field))
+            buffer_append(ctx, "%s  %s  ", SEPARATOR, FIELD_HEADERS[field]);
+    }
+    buffer_append(ctx, "%s", SEPARATOR);
+    if (sparklines && ctx->spark_redraw) print_spark_header(ctx);
+    buffer_append(ctx, "\n");
+
+    ctx->eco.suspended = 0;
+    for (unsigned int i = 0; i < ctx->device_count; i++) {
+        GpuDevice gpu = {0};
+        int suspended = ctx->eco.enabled && ctx->present[i] && gpu_runtime_suspended(ctx, i);
+        ctx->eco.suspended += suspended;
+        int result = ctx->present[i] && !suspended ? get_gpu_temps(ctx, i, &gpu) : 1;
+        if (result < 0) {
+            if (recover_gpu(ctx, i) < 0) return -1;
+            result = 1;
+        }
+        sparklines = ctx->history && ctx->spark_width > 0;
+        if (result == 0) {
+            unsigned int bin;
+            float by;
+            if (gpu.load_read) update_baseline(ctx, i, &gpu, &bin, &by);
+            print_gpu_info(ctx, i, &gpu);
+            if (ctx->history) history_push(&ctx->history[i], &gpu);
+            if (sparklines) print_spark_row(ctx, i);
+        } else {
+            print_placeholder_row(ctx, i, suspended ? " asleep " : "   --   ");
+            if (sparklines && ctx->spark_redraw) print_spark_row(ctx, i);
+        }
+        buffer_append(ctx, "\n");
+        stage_end(ctx, i, STAGE_SERIALIZE);
+        valid_readings++;
+    }
+    // A topology change during the snapshot redraws the next one in full.
+    ctx->spark_redraw = ctx->spark_redraw && !redraw;
+
+    buffer_append(ctx, "\033[%dA", valid_readings + 2);
+    PROBE3(snapshot_publish, (int)ctx->output_format, ctx->device_count, ctx->buffer_pos);
+    stage_start(ctx);
+    fprintf(ctx->output, "%s", ctx->output_buffer);
+    fflush(ctx->output);
+    stage_end(ctx, ctx->device_count, STAGE_WRITE);
+    snapshot_end(ctx, &snapshot_start);
+    return 0;
+}
+
+static int monitor_temperatures_json(Context *ctx) {
+    struct timespec snapshot_start;
+    stage_now(ctx, &snapshot_start);
+    self_stats_begin(ctx);
+    ctx->buffer_pos = 0;
+    time_t now = time(NULL);
+    buffer_append(ctx, "{\"timestamp\":%ld,\"gpus\":[", (long)now);
+
+    ctx->eco.suspended = 0;
+    for (unsigned int i = 0, first = 1; i < ctx->device_count; i++) {
+        GpuDevice gpu = {0};
+        if (!ctx->present[i]) continue;
+        // A GPU changed by a re-enumeration during this snapshot already has
+        // its new index, which the topology record after this one announces.
+        if (ctx->topology_pending && ctx->changes[i]) continue;
+        int suspended = ctx->eco.enabled && gpu_runtime_suspended(ctx, i);
+        if (!suspended && get_gpu_temps(ctx, i, &gpu) < 0) {
+            if (recover_gpu(ctx, i) < 0) return -1;
+            continue;
+        }
+
+        if (!first) {
+            buffer_append(ctx, ",");
+        }
+        first = 0;
+        if (suspended) {
+            buffer_append(ctx, "{\"index\":%u,\"suspended\":true}", ctx->indices[i]);
+            ctx->eco.suspended++;
+            stage_end(ctx, i, STAGE_SERIALIZE);
+            continue;
+        }
+        buffer_append(ctx, "{\"index\":%u", ctx->indices[i]);
+        for (int field = 0; field < FIELD_COUNT; field++) {
+            if (ctx->config.fields & (1u << field))
+                buffer_append(ctx, ",\"%s\":%u", FIELD_NAMES[field], field_value(&gpu, field));
+        }
+        if (ctx->config.oversample > 1 && gpu.registers_read) {
+            buffer_append(ctx, ",\"spread\":{\"%s\":%u,\"%s\":%u},\"rejected\":{\"%s\":%u,\"%s\":%u}",
+                REGISTERS[REG_JUNCTION].name, gpu.spread[REG_JUNCTION],
+                REGISTERS[REG_VRAM].name, gpu.spread[REG_VRAM],
+                REGISTERS[REG_JUNCTION].name, gpu.rejected[REG_JUNCTION],
+                REGISTERS[REG_VRAM].name, gpu.rejected[REG_VRAM]);
+        }
+        unsigned int bin;
+        float by;
+        int regressed = gpu.load_read ? update_baseline(ctx, i, &gpu, &bin, &by) : -1;
+        if (regressed >= 0) {
+            buffer_append(ctx, ",\"regressed\":{\"by\":%.1f,\"field\":\"%s\",\"util\":%u,\"power\":%u}",
+                by, FIELD_NAMES[regressed], bin / BASELINE_POWER_BINS * (100 / BASELINE_UTIL_BINS),
+                bin % BASELINE_POWER_BINS * (100 / BASELINE_POWER_BINS));
+        }
+        append_quality(ctx, &gpu);
+        if (gpu.link_read) append_pcie_link(ctx, i);
+        if (gpu.ecc_checked) append_ecc(ctx, i);
+        buffer_append(ctx, "}");
+        stage_end(ctx, i, STAGE_SERIALIZE);
+    }
+    buffer_append(ctx, "]");
+    if (ctx->queue.dropped) buffer_append(ctx, ",\"dropped\":%llu", ctx->queue.dropped);
+    if (ctx->eco.enabled) buffer_append(ctx, ",\"wakeups_per_min\":%.1f", eco_wakeups_per_min(ctx));
+    append_self_stats(ctx);
+    buffer_append(ctx, "}\n");
+    PROBE3(snapshot_publish, (int)ctx->output_format, ctx->device_count, ctx->buffer_pos);
+    stage_start(ctx);
+    if ((enqueue_record(ctx, ctx->output_buffer, ctx->buffer_pos, 0) < 0) ||
+        (emit_topology_record(ctx) < 0) ||
+        (ctx->output_mode == MODE_ONCE ? drain_output(ctx, 1) : flush_output(ctx)) < 0)
+        return -1;
+    stage_end(ctx, ctx->device_count, STAGE_WRITE);
+    snapshot_end(ctx, &snapshot_start);
+    return 0;
+}
+
+static int init_backend(Context *ctx) {
+    if (ctx->backend == BACKEND_HWMON) return init_hwmon(ctx);
+
+    // Loaded first: the mock library points GPUTEMPS_MEM_PATH and
+    // GPUTEMPS_PCI_DUMP to its own files when it is loaded.
+    if (load_nvml() < 0) return -1;
+    ctx->mem_path = getenv(MEM_PATH_ENV);
+    if (!ctx->mem_path || !*ctx->mem_path) ctx->mem_path = MEM_PATH;
+
+    if ((check_root_privileges(ctx) < 0) ||
+        (init_pci(ctx) < 0) ||
+        (init_nvml(ctx) < 0) ||
+        (get_device_count(ctx) < 0))
+        return -1;
+    return 0;
+}
+
+static int init_monitoring(Context *ctx) {
+    if ((init_backend(ctx) < 0) ||
+        (init_gpu_selection(ctx) < 0) ||
+        (init_topology(ctx) < 0) ||
+        (init_output_buffer(ctx) < 0) ||
+        (init_output(ctx) < 0) ||
+        (init_history(ctx) < 0) ||
+        (init_quality(ctx) < 0) ||
+        (init_baseline(ctx) < 0) ||
+        (init_pcie_links(ctx) < 0) ||
+        (init_ecc(ctx) < 0) ||
+        (init_self_stats(ctx) < 0) ||
+        (init_eco(ctx) < 0) ||
+        (init_trace(ctx) < 0) ||
+        (init_histograms(ctx) < 0) ||
+        (init_raw_capture(ctx) < 0))
+        return -1;
+
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+    signal(SIGHUP, ctx->config_path ? reload_signal_handler : signal_handler);
+
+    return 0;
+}
+
+/* Sleeps for duration_ms, writing queued output whenever the sink can take
+ * more. Returns 1 on a key press and -1 if the output fails. */
+static int handle_input(Context *ctx, int duration_ms) {
+    static int stdin_closed = 0;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t deadline_ns = timespec_ns(&now) + (uint64_t)duration_ms * 1000000;
+
+    for (;;) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (timespec_ns(&now) >= deadline_ns) return 0;
+        uint64_t remaining_us = (deadline_ns - timespec_ns(&now)) / 1000;
+        struct timeval tv = {remaining_us / 1000000, remaining_us % 1000000};
+
+        fd_set read_fds, write_fds;
+        FD_ZERO(&read_fds);
+        FD_ZERO(&write_fds);
+        int nfds = 0;
+        if (!stdin_closed) {
+            FD_SET(STDIN_FILENO, &read_fds);
+            nfds = STDIN_FILENO + 1;
+        }
+        // The compression thread takes records from the next sample on.
+        int output_fd = ctx->queue.flushing && !ctx->compressor.enabled ? ctx->queue.fd : -1;
+        if (output_fd >= 0) {
+            FD_SET(output_fd, &write_fds);
+            if (output_fd >= nfds) nfds = output_fd + 1;
+        }
+
+        if (select(nfds, &read_fds, &write_fds, NULL, &tv) <= 0) return 0;
+        if (FD_ISSET(STDIN_FILENO, &read_fds)) {
+            char c;
+            if (read(STDIN_FILENO, &c, 1) > 0) return 1;
+            // stdin at EOF (e.g. /dev/null under a service manager) stays
+            // readable forever; stop watching it and sleep out the interval.
+            stdin_closed = 1;
+        }
+        if (output_fd >= 0 && FD_ISSET(output_fd, &write_fds) && drain_output(ctx, 0) < 0)
+            return -1;
+    }
+}
+
+static int run_monitoring_loop(Context *ctx) {
+    while (running) {
+        if (monitor_temperatures_table(ctx) != 0) return -1;
+        handle_dump_request(ctx);
+        handle_reload_request(ctx);
+        if (handle_topology_check(ctx) < 0) return -1;
+        // A failed save is reported and retried; the profiles stay in memory.
+        handle_baseline_save(ctx);
+        handle_ecc_save(ctx);
+        if (handle_input(ctx, sample_interval_ms(ctx))) break;
+    }
+
+    report_eco(ctx);
+    printf("\033[%dB", ctx->device_count + 2);
+    printf("\n");
+    fflush(stdout);
+    return 0;
+}
+
+static int run_json_loop(Context *ctx) {
+    while (running) {
+        if (monitor_temperatures_json(ctx) != 0) return -1;
+        handle_dump_request(ctx);
+        handle_reload_request(ctx);
+        if (handle_topology_check(ctx) < 0) return -1;
+        // A failed save is reported and retried; the profiles stay in memory.
+        handle_baseline_save(ctx);
+        handle_ecc_save(ctx);
+        int input = handle_input(ctx, sample_interval_ms(ctx));
+        if (input < 0) return -1;
+        if (input) break;
+    }
+    if (drain_output(ctx, 1) < 0) return -1;
+    report_eco(ctx);
+    return 0;
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void print_bench_report(Context *ctx, Bench *bench, double elapsed) {
+    uint32_t *values = malloc(bench->iterations * sizeof(uint32_t));
+    if (!values) {
+        fprintf(stderr, "Failed to allocate benchmark report\n");
+        return;
+    }
+
+    printf("%u iterations, %u GPUs, %.3f s, %.1f snapshots/s\n\n",
+        bench->iterations, ctx->device_count, elapsed, bench->iterations / elapsed);
+    printf("%-5s %-10s %10s %10s %10s %10s %10s\n",
+        "GPU", "STAGE", "MEAN_US", "P50_US", "P90_US", "P99_US", "MAX_US");
+
+    for (unsigned int row = 0; row < bench->rows; row++) {
+        int snapshot_row = row == ctx->device_count;
+        for (int stage = 0; stage < STAGE_COUNT; stage++) {
+            if (snapshot_row != (stage == STAGE_WRITE || stage == STAGE_SNAPSHOT)) continue;
+
+            double sum = 0;
+            for (unsigned int i = 0; i < bench->iterations; i++) {
+                values[i] = bench->samples[((size_t)i * bench->rows + row) * STAGE_COUNT + stage];
+                sum += values[i];
+            }
+            qsort(values, bench->iterations, sizeof(uint32_t), compare_u32);
+            if (values[bench->iterations - 1] == 0) continue; // not on this backend's path
+
+            char label[16];
+            if (snapshot_row) snprintf(label, sizeof(label), "all");
+            else snprintf(label, sizeof(label), "%u", ctx->indices[row]);
+            printf("%-5s %-10s %10.2f %10.2f %10.2f %10.2f %10.2f\n",
+                label, STAGE_NAMES[stage],
+                sum / bench->iterations / 1e3,
+                values[bench->iterations / 2] / 1e3,
+                values[(size_t)(bench->iterations * 0.90)] / 1e3,
+                values[(size_t)(bench->iterations * 0.99)] / 1e3,
+                values[bench->iterations - 1] / 1e3);
+        }
+    }
+    fflush(stdout);
+    free(values);
+}
+
+static int run_bench(Context *ctx, unsigned int iterations) {
+    Bench bench = {0};
+    bench.iterations = iterations;
+    bench.rows = ctx->device_count + 1;
+    bench.samples = calloc((size_t)iterations * bench.rows * STAGE_COUNT, sizeof(uint32_t));
+    if (!bench.samples) {
+        fprintf(stderr, "Failed to allocate benchmark samples\n");
+        return -1;
+    }
+
+    FILE *null_output = fopen("/dev/null", "w");
+    if (!null_output) {
+        fprintf(stderr, "Failed to open /dev/null: %s\n", strerror(errno));
+        free(bench.samples);
+        return -1;
+    }
+
+    int result = 0;
+    struct timespec start, end;
+    // JSON records go through the queue's own fd, so it is pointed at
+    // /dev/null as well, once what is queued for the real output is out.
+    FILE *output = ctx->output;
+    ctx->output = null_output;
+    if (ctx->queue.data) {
+        drain_output(ctx, 1);
+        open_output_sink(&ctx->queue, null_output);
+    }
+    ctx->bench = &bench;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (bench.iteration = 0; running && bench.iteration < iterations; bench.iteration++) {
+        result = ctx->output_format == FORMAT_JSON
+            ? monitor_temperatures_json(ctx)
+            : monitor_temperatures_table(ctx);
+        if (result != 0) break;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ctx->bench = NULL;
+    if (ctx->queue.data) {
+        drain_output(ctx, 1);
+        open_output_sink(&ctx->queue, output);
+    }
+    ctx->output = output;
+    fclose(null_output);
+
+    bench.iterations = bench.iteration;
+    if (result == 0 && bench.iterations > 0) {
+        print_bench_report(ctx, &bench,
+            (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+    }
+    free(bench.samples);
+    return result;
+}
+
 typedef struct {
-    nvmlReturn_t result;
-    unsigned int device_count;
-    int initialized;
-    struct pci_access *pacc;
-    char output_buffer[BUFFER_SIZE];
-    size_t buffer_pos;
-    OutputMode output_mode;
-    OutputFormat output_format;
-} Context;
+    uint32_t word;
+    uint8_t shift;
+    uint8_t width;
+    uint32_t samples;
+    uint32_t min_value;
+    uint32_t max_value;
+    double sum_value;
+    double sum_value_sq;
+    double sum_core;
+    double sum_core_sq;
+    double sum_product;
+    double correlation;
+} ScanCandidate;
 
 typedef struct {
+    unsigned int index;
     nvmlDevice_t device;
-    nvmlPciInfo_t pci_info;
-    uint32_t gpu_temp;
-    uint32_t junction_temp;
-    uint32_t vram_temp;
-} GpuDevice;
+    void *map_base;
+    size_t map_size;
+    const volatile uint32_t *window;
+    size_t words;
+    uint32_t *snapshot;
+    uint32_t *mask7;
+    uint32_t *mask8;
+    size_t alive;
+    ScanCandidate *tracked;
+    size_t tracked_count;
+    int tracking;
+    unsigned int sweeps;
+    uint32_t min_core;
+    uint32_t max_core;
+} ScanGpu;
 
-static int check_root_privileges(void) {
-    if (geteuid() != 0) {
-        fprintf(stderr, "This program requires root privileges\n");
-        return -1;
-    }
-    return 0;
+static size_t popcount_masks(const uint32_t *masks, size_t count) {
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) total += __builtin_popcount(masks[i]);
+    return total;
 }
 
-static void cleanup_context(Context *ctx) {
-    if (!ctx) return;
+/* Clears the candidate bits of every word whose field at a given shift is not
+ * within [low, high]. Works on 8 words at a time with vector extensions, which
+ * the compiler lowers to SSE, AVX2 or NEON, and skips blocks with no candidate
+ * left, so later sweeps only touch the few surviving words. */
+static void scan_filter(ScanGpu *gpu, uint32_t low, uint32_t high) {
+    const u32x8 zero = {0};
+    const u32x8 low_v = zero + low;
+    const u32x8 high_v = zero + high;
 
-    if (ctx->initialized) {
-        nvmlShutdown();
-        ctx->initialized = 0;
-    }
+    for (size_t i = 0; i < gpu->words; i += 8) {
+        u32x8 words, mask7, mask8;
+        memcpy(&mask7, &gpu->mask7[i], sizeof(mask7));
+        memcpy(&mask8, &gpu->mask8[i], sizeof(mask8));
+        u32x8 any = mask7 | mask8;
+        if (!(any[0] | any[1] | any[2] | any[3] | any[4] | any[5] | any[6] | any[7]))
+            continue;
+        memcpy(&words, &gpu->snapshot[i], sizeof(words));
 
-    if (ctx->pacc) {
-        pci_cleanup(ctx->pacc);
-        ctx->pacc = NULL;
+        u32x8 keep7 = zero, keep8 = zero;
+        for (unsigned int shift = 0; shift < SCAN_SHIFTS_7; shift++) {
+            u32x8 field = (words >> shift) & 0x7f;
+            keep7 |= (u32x8)((field >= low_v) & (field <= high_v)) & (1u << shift);
+        }
+        for (unsigned int shift = 0; shift < SCAN_SHIFTS_8; shift++) {
+            u32x8 field = (words >> shift) & 0xff;
+            keep8 |= (u32x8)((field >= low_v) & (field <= high_v)) & (1u << shift);
+        }
+
+        mask7 &= keep7;
+        mask8 &= keep8;
+        memcpy(&gpu->mask7[i], &mask7, sizeof(mask7));
+        memcpy(&gpu->mask8[i], &mask8, sizeof(mask8));
     }
-}
 
-static void signal_handler(int signum) {
-    running = 0;
+    gpu->alive = popcount_masks(gpu->mask7, gpu->words) + popcount_masks(gpu->mask8, gpu->words);
 }
 
-static void restore_cursor(void) {
-    printf(CURSOR_SHOW);
-    fflush(stdout);
+static void scan_start_tracking(ScanGpu *gpu) {
+    gpu->tracked = calloc(gpu->alive ? gpu->alive : 1, sizeof(ScanCandidate));
+    if (!gpu->tracked) return;
+
+    for (size_t i = 0; i < gpu->words; i++) {
+        for (unsigned int width = 7; width <= 8; width++) {
+            uint32_t mask = width == 7 ? gpu->mask7[i] : gpu->mask8[i];
+            while (mask) {
+                ScanCandidate *candidate = &gpu->tracked[gpu->tracked_count++];
+                candidate->word = (uint32_t)i;
+                candidate->shift = (uint8_t)__builtin_ctz(mask);
+                candidate->width = (uint8_t)width;
+                candidate->min_value = UINT32_MAX;
+                mask &= mask - 1;
+            }
+        }
+    }
+    gpu->tracking = 1;
 }
 
-static void reset_terminal(void) {
-    tcsetattr(STDIN_FILENO, TCSANOW, &orig_termios);
+static void scan_track(ScanGpu *gpu, uint32_t core) {
+    size_t kept = 0;
+    for (size_t i = 0; i < gpu->tracked_count; i++) {
+        ScanCandidate candidate = gpu->tracked[i];
+        uint32_t mask = candidate.width == 7 ? gpu->mask7[candidate.word] : gpu->mask8[candidate.word];
+        if (!(mask & (1u << candidate.shift))) continue;
+
+        RegisterField field = {NULL, 0, candidate.shift, candidate.width};
+        uint32_t value = decode_register(&field, gpu->snapshot[candidate.word]);
+        candidate.samples++;
+        if (value < candidate.min_value) candidate.min_value = value;
+        if (value > candidate.max_value) candidate.max_value = value;
+        candidate.sum_value += value;
+        candidate.sum_value_sq += (double)value * value;
+        candidate.sum_core += core;
+        candidate.sum_core_sq += (double)core * core;
+        candidate.sum_product += (double)value * core;
+        gpu->tracked[kept++] = candidate;
+    }
+    gpu->tracked_count = kept;
 }
 
-static int setup_terminal(void) {
-    struct termios new_termios;
+static int scan_sweep(ScanGpu *gpu) {
+    uint32_t core;
+    if (get_gpu_temp(gpu->index, gpu->device, &core) < 0) return -1;
 
-    if (tcgetattr(STDIN_FILENO, &orig_termios) < 0) return -1;
-    atexit(reset_terminal);
-    new_termios = orig_termios;
-    new_termios.c_lflag &= ~(ICANON | ECHO);
-    new_termios.c_cc[VMIN] = 0;
-    new_termios.c_cc[VTIME] = 0;
-    if (tcsetattr(STDIN_FILENO, TCSANOW, &new_termios) < 0) return -1;
+    // Only words that still hold a candidate are read: MMIO reads are slow
+    // and most of the window is ruled out after the first sweeps.
+    for (size_t i = 0; i < gpu->words; i++) {
+        if (gpu->mask7[i] | gpu->mask8[i]) gpu->snapshot[i] = gpu->window[i];
+    }
+
+    scan_filter(gpu, core > SCAN_BELOW ? core - SCAN_BELOW : 0, core + SCAN_ABOVE);
+    if (!gpu->tracking && gpu->alive <= SCAN_MAX_TRACKED) scan_start_tracking(gpu);
+    if (gpu->tracking) scan_track(gpu, core);
+
+    if (gpu->sweeps == 0 || core < gpu->min_core) gpu->min_core = core;
+    if (gpu->sweeps == 0 || core > gpu->max_core) gpu->max_core = core;
+    gpu->sweeps++;
     return 0;
 }
 
-static void buffer_append(Context *ctx, const char *format, ...) {
-    va_list args;
-    va_start(args, format);
-    int remaining = BUFFER_SIZE - ctx->buffer_pos;
-    int written = vsnprintf(ctx->output_buffer + ctx->buffer_pos, remaining, format, args);
-    if (written > 0 && written < remaining) ctx->buffer_pos += written;
-    va_end(args);
+static int compare_candidates(const void *a, const void *b) {
+    const ScanCandidate *x = a, *y = b;
+    return (x->correlation < y->correlation) - (x->correlation > y->correlation);
 }
 
-static const char* get_temp_color(uint32_t temp, uint32_t warn, uint32_t danger) {
-    if (temp >= danger) return COLOR_RED;
-    if (temp >= warn) return COLOR_YELLOW;
-    return COLOR_GREEN;
+/* Orders fields by word, then shift, then width, so a 7-bit field sorts
+ * right before the 8-bit one at the same shift. */
+static int compare_candidate_fields(const void *a, const void *b) {
+    const ScanCandidate *x = a, *y = b;
+    if (x->word != y->word) return x->word < y->word ? -1 : 1;
+    if (x->shift != y->shift) return x->shift < y->shift ? -1 : 1;
+    return (x->width > y->width) - (x->width < y->width);
 }
 
-static void print_gpu_info(Context *ctx, unsigned int index, GpuDevice *gpu) {
-    buffer_append(ctx, "%u %s %s%3u°C%s  %s %s%3u°C%s  %s %s%3u°C%s  %s\n",
-        index, SEPARATOR,
-        get_temp_color(gpu->gpu_temp, GPU_TEMP_WARN, GPU_TEMP_DANGER),
-        gpu->gpu_temp, COLOR_RESET, SEPARATOR,
-        get_temp_color(gpu->junction_temp, JUNCTION_TEMP_WARN, JUNCTION_TEMP_DANGER),
-        gpu->junction_temp, COLOR_RESET, SEPARATOR,
-        get_temp_color(gpu->vram_temp, VRAM_TEMP_WARN, VRAM_TEMP_DANGER),
-        gpu->vram_temp, COLOR_RESET, SEPARATOR);
-}
+static void scan_report(ScanGpu *gpu, uint32_t window_size) {
+    size_t found = 0;
+    qsort(gpu->tracked, gpu->tracked_count, sizeof(ScanCandidate), compare_candidate_fields);
+    for (size_t i = 0; i < gpu->tracked_count; i++) {
+        ScanCandidate *candidate = &gpu->tracked[i];
+        double n = candidate->samples;
+        double var_value = n * candidate->sum_value_sq - candidate->sum_value * candidate->sum_value;
+        double var_core = n * candidate->sum_core_sq - candidate->sum_core * candidate->sum_core;
+        if (candidate->samples < SCAN_MIN_SAMPLES || var_value <= 0 || var_core <= 0) continue;
 
-static int init_pci(Context *ctx) {
-    ctx->pacc = pci_alloc();
-    if (!ctx->pacc) {
-        fprintf(stderr, "Failed to allocate PCI structure\n");
-        return -1;
-    }
-    pci_init(ctx->pacc);
-    pci_scan_bus(ctx->pacc);
-    return 0;
-}
+        // Squared correlation, so no square root is needed; the sign rules out
+        // fields that move against the core temperature.
+        double covariance = n * candidate->sum_product - candidate->sum_value * candidate->sum_core;
+        if (covariance <= 0) continue;
+        candidate->correlation = covariance * covariance / (var_value * var_core);
+        if (candidate->correlation < SCAN_MIN_R2) continue;
 
-static int init_nvml(Context *ctx) {
-    ctx->result = nvmlInit();
-    if (NVML_SUCCESS != ctx->result) {
-        fprintf(stderr, "Failed to initialize NVML: %s\n",
-          nvmlErrorString(ctx->result));
-        return -1;
+        // A 7-bit field equal to the 8-bit one at the same shift adds nothing.
+        if (candidate->width == 7 && i + 1 < gpu->tracked_count) {
+            ScanCandidate *wider = &gpu->tracked[i + 1];
+            if (wider->word == candidate->word && wider->shift == candidate->shift &&
+                wider->width == 8 && wider->sum_value == candidate->sum_value) continue;
+        }
+        gpu->tracked[found++] = *candidate;
     }
-    ctx->initialized = 1;
-    return 0;
-}
+    qsort(gpu->tracked, found, sizeof(ScanCandidate), compare_candidates);
 
-static int get_device_count(Context *ctx) {
-    ctx->result = nvmlDeviceGetCount(&ctx->device_count);
-    if (NVML_SUCCESS != ctx->result) {
-        fprintf(stderr, "Failed to get device count: %s\n",
-          nvmlErrorString(ctx->result));
-        return -1;
+    printf("GPU %u: %u sweeps over 0x%08X bytes, core %u-%u°C, %zu candidate%s\n",
+        gpu->index, gpu->sweeps, window_size, gpu->min_core, gpu->max_core,
+        found, found == 1 ? "" : "s");
+    if (gpu->max_core - gpu->min_core < SCAN_MIN_CORE_RANGE) {
+        printf("  core temperature barely moved, load and idle the GPU during the scan\n");
     }
-    if (ctx->device_count == 0) {
-        fprintf(stderr, "No NVIDIA GPUs found\n");
-        return -1;
+
+    for (size_t i = 0; i < found && i < SCAN_MAX_RESULTS; i++) {
+        ScanCandidate *candidate = &gpu->tracked[i];
+        printf("    {\"candidate\", 0x%08X, %u, %u}, // r2=%.3f, %u-%u°C, %+.1f°C vs core\n",
+            candidate->word * 4, candidate->shift, candidate->width, candidate->correlation,
+            candidate->min_value, candidate->max_value,
+            (candidate->sum_value - candidate->sum_core) / candidate->samples);
     }
-    return 0;
+    fflush(stdout);
 }
 
-static int get_device_handle(Context *ctx, unsigned int index, nvmlDevice_t *device) {
-    ctx->result = nvmlDeviceGetHandleByIndex(index, device);
-    if (NVML_SUCCESS != ctx->result) {
-        fprintf(stderr, "Failed to get handle for GPU %u: %s\n",
-          index, nvmlErrorString(ctx->result));
+static void cleanup_scan_gpu(ScanGpu *gpu) {
+    if (gpu->map_base && gpu->map_base != MAP_FAILED) munmap(gpu->map_base, gpu->map_size);
+    free(gpu->snapshot);
+    free(gpu->mask7);
+    free(gpu->mask8);
+    free(gpu->tracked);
+}
+
+static int init_scan_gpu(Context *ctx, ScanGpu *gpu, unsigned int index,
+                         int fd, uint32_t window_size) {
+    nvmlPciInfo_t pci_info;
+    gpu->index = index;
+    if ((get_device_handle(ctx, index, &gpu->device) < 0) ||
+        (get_device_pci_info(ctx, index, gpu->device, &pci_info) < 0))
+        return -1;
+
+    struct pci_dev *dev = find_pci_dev(ctx, &pci_info);
+    if (!dev) {
+        fprintf(stderr, "No PCI device found for GPU %u\n", index);
         return -1;
     }
-    return 0;
-}
 
-static int get_device_pci_info(Context *ctx, nvmlDevice_t device, nvmlPciInfo_t *pci_info) {
-    ctx->result = nvmlDeviceGetPciInfo(device, pci_info);
-    if (NVML_SUCCESS != ctx->result) {
-        fprintf(stderr, "Failed to get PCI info: %s\n",
-          nvmlErrorString(ctx->result));
+    uint32_t bar = dev->base_addr[0] & 0xFFFFFFFF;
+    uint32_t base_offset = bar & ~(PG_SZ-1);
+    gpu->map_size = window_size + (bar - base_offset);
+    gpu->map_base = mmap(0, gpu->map_size, PROT_READ, MAP_SHARED, fd, base_offset);
+    if (gpu->map_base == MAP_FAILED) {
+        fprintf(stderr, "Failed to map BAR0 of GPU %u: %s\n", index, strerror(errno));
+        gpu->map_base = NULL;
         return -1;
     }
-    return 0;
-}
+    gpu->window = (const volatile uint32_t *)((char *)gpu->map_base + (bar - base_offset));
 
-static int get_gpu_temp(nvmlDevice_t device, uint32_t *temp) {
-    nvmlReturn_t result = nvmlDeviceGetTemperature(device, NVML_TEMPERATURE_GPU, temp);
-    if (NVML_SUCCESS != result) {
-        fprintf(stderr, "Failed to get GPU temperature: %s\n",
-          nvmlErrorString(result));
+    gpu->words = window_size / sizeof(uint32_t);
+    gpu->snapshot = aligned_alloc(32, gpu->words * sizeof(uint32_t));
+    gpu->mask7 = aligned_alloc(32, gpu->words * sizeof(uint32_t));
+    gpu->mask8 = aligned_alloc(32, gpu->words * sizeof(uint32_t));
+    if (!gpu->snapshot || !gpu->mask7 || !gpu->mask8) {
+        fprintf(stderr, "Failed to allocate scan buffers\n");
         return -1;
     }
+    for (size_t i = 0; i < gpu->words; i++) {
+        gpu->mask7[i] = (1u << SCAN_SHIFTS_7) - 1;
+        gpu->mask8[i] = (1u << SCAN_SHIFTS_8) - 1;
+    }
     return 0;
 }
 
-static int read_register_temp(struct pci_dev *dev, uint32_t offset, uint32_t *temp) {
-    int fd = open(MEM_PATH, O_RDWR | O_SYNC);
+/* Maps a BAR0 window of every GPU and samples it while the GPU heats and
+ * cools, keeping the bitfields that stay close to the NVML core temperature,
+ * then ranks them by correlation with it. */
+static int run_scan(Context *ctx, uint32_t window_size, unsigned int duration) {
+    int fd = open(ctx->mem_path, O_RDONLY | O_SYNC);
     if (fd < 0) {
-        fprintf(stderr, "Failed to open %s: %s\n", MEM_PATH, strerror(errno));
+        fprintf(stderr, "Failed to open %s: %s\n", ctx->mem_path, strerror(errno));
         return -1;
     }
 
-    uint32_t reg_addr = (dev->base_addr[0] & 0xFFFFFFFF) + offset;
-    uint32_t base_offset = reg_addr & ~(PG_SZ-1);
-    void *map_base = mmap(0, PG_SZ, PROT_READ, MAP_SHARED, fd, base_offset);
-    if (map_base == MAP_FAILED) {
-        fprintf(stderr, "Failed to map memory: %s\n", strerror(errno));
+    ScanGpu *gpus = calloc(ctx->device_count, sizeof(ScanGpu));
+    if (!gpus) {
+        fprintf(stderr, "Failed to allocate scan state\n");
         close(fd);
         return -1;
     }
 
-    uint32_t reg_value = *((uint32_t *)((char *)map_base + (reg_addr - base_offset)));
+    int result = 0;
+    for (unsigned int i = 0; i < ctx->device_count && result == 0; i++)
+        result = init_scan_gpu(ctx, &gpus[i], ctx->indices[i], fd, window_size);
+    close(fd);
+
+    if (result == 0) {
+        fprintf(stderr, "Scanning 0x%08X bytes of BAR0 for %u s, "
+            "alternate load and idle on the GPUs meanwhile\n", window_size, duration);
+
+        struct timespec start, now;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        now = start;
+        while (running && result == 0 && now.tv_sec - start.tv_sec < (time_t)duration) {
+            for (unsigned int i = 0; i < ctx->device_count && result == 0; i++)
+                result = scan_sweep(&gpus[i]);
 
-    if (offset == HOTSPOT_REGISTER_OFFSET) {
-        *temp = (reg_value >> 8) & 0xff;
-    } else if (offset == VRAM_REGISTER_OFFSET) {
-        *temp = (reg_value & 0x00000fff) / 0x20;
+            if (gpus[0].sweeps % SCAN_PROGRESS_SWEEPS == 0) {
+                fprintf(stderr, "%lds: GPU %u at %u-%u°C, %zu candidates left\n",
+                    (long)(now.tv_sec - start.tv_sec), gpus[0].index, gpus[0].min_core, gpus[0].max_core,
+                    gpus[0].alive);
+            }
+            struct timespec delay = {0, SCAN_INTERVAL_MS * 1000000L};
+            nanosleep(&delay, NULL);
+            clock_gettime(CLOCK_MONOTONIC, &now);
+        }
     }
 
-    munmap(map_base, PG_SZ);
-    close(fd);
+    if (result == 0) {
+        for (unsigned int i = 0; i < ctx->device_count; i++)
+            scan_report(&gpus[i], window_size);
+    }
 
-    return (*temp < 0x7f) ? 0 : -1;
+    for (unsigned int i = 0; i < ctx->device_count; i++) cleanup_scan_gpu(&gpus[i]);
+    free(gpus);
+    return result;
 }
 
-static int get_gpu_temps(Context *ctx, unsigned int index, GpuDevice *gpu) {
-    if ((get_device_handle(ctx, index, &gpu->device) < 0) ||
-        (get_gpu_temp(gpu->device, &gpu->gpu_temp) < 0) ||
-        (get_device_pci_info(ctx, gpu->device, &gpu->pci_info) < 0))
-        return -1;
-
-    for (struct pci_dev *dev = ctx->pacc->devices; dev; dev = dev->next) {
-        pci_fill_info(dev, PCI_FILL_IDENT | PCI_FILL_BASES);
+/* Normal equations of a least-squares fit of T[k] = a*T[k-m] + b*P + c, where
+ * P is the mean power over the lag. Constant size, whatever the run length. */
+typedef struct {
+    double xx[3][3];
+    double xy[3];
+    double yy;
+    double lag_s;
+    uint32_t samples;
+} ThermalFit;
 
-        if ((dev->device_id << 16 | dev->vendor_id) != gpu->pci_info.pciDeviceId ||
-            (unsigned int)dev->domain != gpu->pci_info.domain ||
-            dev->bus != gpu->pci_info.bus ||
-            dev->dev != gpu->pci_info.device) {
-            continue;
-        }
+typedef struct {
+    unsigned int index;
+    unsigned int power_limit_mw;
+    double power_ema;
+    int ema_ready;
+    double window_until;
+    unsigned int windows;
+    unsigned int min_power_w;
+    unsigned int max_power_w;
+    unsigned int head;
+    unsigned int filled;
+    double times[STEP_LAG_SAMPLES];
+    double power[STEP_LAG_SAMPLES];
+    uint32_t temps[STEP_LAG_SAMPLES][FIELD_COUNT];
+    ThermalFit fits[FIELD_COUNT];
+} StepGpu;
 
-        int junction_result =
-          read_register_temp(dev, HOTSPOT_REGISTER_OFFSET, &gpu->junction_temp);
-        if (junction_result != 0) return -1;
+static void fit_add(ThermalFit *fit, const double x[3], double y, double lag_s) {
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) fit->xx[i][j] += x[i] * x[j];
+        fit->xy[i] += x[i] * y;
+    }
+    fit->yy += y * y;
+    fit->lag_s += lag_s;
+    fit->samples++;
+}
 
-        int vram_result =
-          read_register_temp(dev, VRAM_REGISTER_OFFSET, &gpu->vram_temp);
-        if (vram_result != 0) return -1;
+/* Gaussian elimination with partial pivoting. Fails when the power barely
+ * moved, since its coefficient and the constant can then not be told apart. */
+static int fit_solve(const ThermalFit *fit, double theta[3]) {
+    double m[3][4];
+    double scale = 0;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) m[i][j] = fit->xx[i][j];
+        m[i][3] = fit->xy[i];
+        if (m[i][i] > scale) scale = m[i][i];
+    }
 
-        return 0;
+    for (int col = 0; col < 3; col++) {
+        int pivot = col;
+        for (int row = col + 1; row < 3; row++) {
+            double a = m[row][col] < 0 ? -m[row][col] : m[row][col];
+            double b = m[pivot][col] < 0 ? -m[pivot][col] : m[pivot][col];
+            if (a > b) pivot = row;
+        }
+        double p = m[pivot][col] < 0 ? -m[pivot][col] : m[pivot][col];
+        if (p <= scale * 1e-12) return -1;
+        for (int j = 0; j < 4; j++) {
+            double t = m[col][j];
+            m[col][j] = m[pivot][j];
+            m[pivot][j] = t;
+        }
+        for (int row = col + 1; row < 3; row++) {
+            double factor = m[row][col] / m[col][col];
+            for (int j = col; j < 4; j++) m[row][j] -= factor * m[col][j];
+        }
+    }
+    for (int row = 2; row >= 0; row--) {
+        double sum = m[row][3];
+        for (int j = row + 1; j < 3; j++) sum -= m[row][j] * theta[j];
+        theta[row] = sum / m[row][row];
     }
+    return 0;
+}
 
-    return -1;
+/* How long a window opened now records, which the end of the run can cut. */
+static int step_window_s(double elapsed, unsigned int duration) {
+    double left = duration - elapsed;
+    return left < STEP_WINDOW_S ? (int)(left + 0.5) : STEP_WINDOW_S;
 }
 
-static int monitor_temperatures_table(Context *ctx) {
-    static int refresh_counter = 0;
-    int valid_readings = 0;
+static void step_open_window(StepGpu *step, double elapsed) {
+    if (elapsed >= step->window_until) step->windows++;
+    step->window_until = elapsed + STEP_WINDOW_S;
+}
 
-    ctx->buffer_pos = 0;
-    refresh_counter = refresh_counter == 0 ? 1 : 0;
-    buffer_append(ctx, "\n%s", refresh_counter == 0 ? "* " : "  ");
-    buffer_append(ctx, "%s  CORE  %s  JUNC  %s  VRAM  %s\n",
-      SEPARATOR, SEPARATOR, SEPARATOR, SEPARATOR);
+/* Feeds one sample to a GPU's fits. Only samples inside a window are fitted,
+ * but every sample goes through the lag ring, so the first fitted one looks
+ * back at the temperatures from before the step. */
+static void step_sample(StepGpu *step, const GpuDevice *gpu, double elapsed,
+                        unsigned int duration, FILE *record) {
+    double power = gpu->power_mw / 1000.0;
+    double threshold = step->power_limit_mw / 1000.0 * STEP_LIMIT_PERCENT / 100;
+    if (threshold < STEP_MIN_W) threshold = STEP_MIN_W;
+    if (!step->ema_ready) {
+        step->power_ema = power;
+        step->ema_ready = 1;
+    }
 
-    for (unsigned int i = 0; i < ctx->device_count; i++) {
-        GpuDevice gpu = {0};
-        if (get_gpu_temps(ctx, i, &gpu) != 0) return -1;
-        print_gpu_info(ctx, i, &gpu);
-        valid_readings++;
+    double change = power - step->power_ema;
+    if (change >= threshold || -change >= threshold) {
+        if (elapsed >= step->window_until) {
+            fprintf(stderr, "%.0fs: GPU %u power %.0f -> %.0f W, recording for %d s\n",
+                elapsed, step->index, step->power_ema, power, step_window_s(elapsed, duration));
+        }
+        step_open_window(step, elapsed);
+        // Re-armed at the new level: a slow ramp extends the window instead
+        // of opening one per sample.
+        step->power_ema = power;
+    } else {
+        step->power_ema += change / STEP_EMA_SAMPLES;
     }
 
-    buffer_append(ctx, "\033[%dA", valid_readings + 2);
-    printf("%s", ctx->output_buffer);
-    fflush(stdout);
-    return 0;
-}
+    int in_window = elapsed < step->window_until;
+    if (in_window && step->filled == STEP_LAG_SAMPLES) {
+        unsigned int oldest = step->head;
+        double mean_power = 0;
+        for (int i = 0; i < STEP_LAG_SAMPLES; i++) mean_power += step->power[i];
+        mean_power /= STEP_LAG_SAMPLES;
 
-static int monitor_temperatures_json(Context *ctx) {
-    ctx->buffer_pos = 0;
-    time_t now = time(NULL);
-    buffer_append(ctx, "{\"timestamp\":%ld,\"gpus\":[", (long)now);
+        for (int field = 0; field < FIELD_COUNT; field++) {
+            uint32_t before = step->temps[oldest][field];
+            uint32_t now = field_value(gpu, field);
+            if (before == 0 || now == 0) continue;
+            double x[3] = {before, mean_power, 1};
+            fit_add(&step->fits[field], x, now, elapsed - step->times[oldest]);
+        }
+        unsigned int watts = (unsigned int)(power + 0.5);
+        if (step->max_power_w == 0 || watts < step->min_power_w) step->min_power_w = watts;
+        if (watts > step->max_power_w) step->max_power_w = watts;
+    }
+    if (in_window && record) {
+        fprintf(record, "%.3f,%u,%u,%.1f,%u,%u,%u,%u\n", elapsed, step->index, step->windows,
+            power, gpu->utilization, gpu->gpu_temp, gpu->junction_temp, gpu->vram_temp);
+    }
 
-    for (unsigned int i = 0; i < ctx->device_count; i++) {
-        GpuDevice gpu = {0};
-        if (get_gpu_temps(ctx, i, &gpu) != 0) return -1;
+    step->times[step->head] = elapsed;
+    step->power[step->head] = power;
+    for (int field = 0; field < FIELD_COUNT; field++)
+        step->temps[step->head][field] = field_value(gpu, field);
+    step->head = (step->head + 1) % STEP_LAG_SAMPLES;
+    if (step->filled < STEP_LAG_SAMPLES) step->filled++;
+}
 
-        if (i > 0) {
-            buffer_append(ctx, ",");
+/* Converts a fit to the continuous first-order model: T settles at
+ * ambient + rise * P with time constant tau. The error is the RMS of the
+ * prediction one lag ahead, computed from the sums alone. */
+static void step_report(const StepGpu *step) {
+    printf("{\"gpu\":%u,\"windows\":%u,\"power\":[%u,%u]", step->index, step->windows,
+        step->min_power_w, step->max_power_w);
+    for (int field = 0; field < FIELD_COUNT; field++) {
+        const ThermalFit *fit = &step->fits[field];
+        double theta[3];
+        if (fit->samples < STEP_MIN_SAMPLES || fit_solve(fit, theta) < 0 ||
+            theta[0] <= 0 || theta[0] >= 1) {
+            printf(",\"%s\":null", FIELD_NAMES[field]);
+            continue;
+        }
+
+        double sse = fit->yy;
+        for (int i = 0; i < 3; i++) {
+            sse -= 2 * theta[i] * fit->xy[i];
+            for (int j = 0; j < 3; j++) sse += theta[i] * fit->xx[i][j] * theta[j];
         }
-        buffer_append(ctx, "{\"index\":%u,\"core\":%u,\"junction\":%u,\"vram\":%u}",
-               i, gpu.gpu_temp, gpu.junction_temp, gpu.vram_temp);
+        double lag_s = fit->lag_s / fit->samples;
+        printf(",\"%s\":{\"tau\":%.2f,\"rise_per_w\":%.4f,\"ambient\":%.1f,\"rmse\":%.2f,\"samples\":%u}",
+            FIELD_NAMES[field], -lag_s / log(theta[0]), theta[1] / (1 - theta[0]),
+            theta[2] / (1 - theta[0]), sqrt(sse > 0 ? sse / fit->samples : 0), fit->samples);
     }
-    buffer_append(ctx, "]}");
-    printf("%s\n", ctx->output_buffer);
+    printf("}\n");
     fflush(stdout);
-    return 0;
 }
 
-static int init_monitoring(Context *ctx) {
-    if ((check_root_privileges() < 0) ||
-        (init_pci(ctx) < 0) ||
-        (init_nvml(ctx) < 0) ||
-        (get_device_count(ctx) < 0))
+/* Samples every GPU at a high rate and fits a first-order thermal model per
+ * sensor over the windows that follow a load transition, either a power step
+ * or SIGUSR2. Nothing but the fit sums is kept, and the in-window samples are
+ * written to the record file if there is one. */
+static int run_characterize(Context *ctx, unsigned int duration, const char *record_path) {
+    FILE *record = NULL;
+    if (record_path) {
+        record = fopen(record_path, "w");
+        if (!record) {
+            fprintf(stderr, "Failed to open %s: %s\n", record_path, strerror(errno));
+            return -1;
+        }
+        fprintf(record, "time,gpu,window,power,utilization,core,junction,vram\n");
+    }
+
+    unsigned int count = ctx->device_count;
+    StepGpu *steps = calloc(count, sizeof(StepGpu));
+    if (!steps) {
+        fprintf(stderr, "Failed to allocate characterization state\n");
+        if (record) fclose(record);
         return -1;
+    }
+    for (unsigned int row = 0; row < count; row++) {
+        nvmlDevice_t device;
+        steps[row].index = ctx->indices[row];
+        if (get_device_handle(ctx, steps[row].index, &device) < 0) continue;
+        uint64_t start_ns = nvml_probe_start();
+        ctx->result = nvml.nvmlDeviceGetEnforcedPowerLimit(device, &steps[row].power_limit_mw);
+        nvml_probe_end("nvmlDeviceGetEnforcedPowerLimit", steps[row].index, ctx->result, start_ns);
+        if (NVML_SUCCESS != ctx->result) steps[row].power_limit_mw = 0;
+    }
 
-    signal(SIGINT, signal_handler);
-    signal(SIGTERM, signal_handler);
-    signal(SIGHUP, signal_handler);
+    signal(SIGUSR2, mark_signal_handler);
+    fprintf(stderr, "Characterizing for %u s, step the load on the GPUs or send SIGUSR2 "
+        "when it changes\n", duration);
 
-    return 0;
-}
+    int result = 0;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t start_ns = timespec_ns(&now), deadline_ns = start_ns;
+    double elapsed = 0;
+    double next_progress = STEP_PROGRESS_S;
+    while (running && elapsed < duration) {
+        if (mark_requested) {
+            mark_requested = 0;
+            fprintf(stderr, "%.0fs: marked, recording all GPUs for %d s\n", elapsed,
+                step_window_s(elapsed, duration));
+            for (unsigned int row = 0; row < count; row++) step_open_window(&steps[row], elapsed);
+        }
+
+        for (unsigned int row = 0; row < count && row < ctx->device_count; row++) {
+            StepGpu *step = &steps[row];
+            if (step->index != ctx->indices[row]) {
+                memset(step, 0, sizeof(*step));
+                step->index = ctx->indices[row];
+            }
+            GpuDevice gpu = {0};
+            int sampled = ctx->present[row] ? get_gpu_temps(ctx, row, &gpu) : 1;
+            if (sampled < 0 && recover_gpu(ctx, row) < 0) {
+                result = -1;
+                break;
+            }
+            if (sampled == 0 && !gpu.load_read) read_gpu_load(ctx, row, &gpu);
+            if (sampled != 0 || !gpu.load_read) {
+                // A gap breaks the lag ring: fitting across it would mix in
+                // a longer lag than the other samples.
+                step->filled = 0;
+                continue;
+            }
+            // Each GPU is timestamped when it was read, since NVML calls
+            // take a while on many GPUs.
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            step_sample(step, &gpu, (timespec_ns(&now) - start_ns) / 1e9, duration, record);
+        }
+        if (result < 0) break;
 
-static int handle_input(int duration_ms) {
-    struct timeval tv = {0, duration_ms * 1000};
-    fd_set fds;
-    FD_ZERO(&fds);
-    FD_SET(STDIN_FILENO, &fds);
+        if (elapsed >= next_progress) {
+            next_progress += STEP_PROGRESS_S;
+            for (unsigned int row = 0; row < count; row++) {
+                fprintf(stderr, "%.0fs: GPU %u at %.0f W, %u window%s, %u samples fitted\n",
+                    elapsed, steps[row].index, steps[row].power_ema, steps[row].windows,
+                    steps[row].windows == 1 ? "" : "s", steps[row].fits[FIELD_CORE].samples);
+            }
+        }
 
-    if (select(STDIN_FILENO + 1, &fds, NULL, NULL, &tv) > 0) {
-        char c;
-        if (read(STDIN_FILENO, &c, 1) > 0) return 1;
+        // Sleeps to an absolute deadline so the period does not drift with
+        // the sampling time. A late sample moves the schedule instead of
+        // being followed by a burst.
+        deadline_ns += STEP_INTERVAL_MS * 1000000ULL;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (deadline_ns < timespec_ns(&now)) deadline_ns = timespec_ns(&now);
+        struct timespec deadline = {deadline_ns / 1000000000, deadline_ns % 1000000000};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR && running) {}
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        elapsed = (timespec_ns(&now) - start_ns) / 1e9;
     }
-    return 0;
+
+    if (result == 0) {
+        for (unsigned int row = 0; row < count; row++) step_report(&steps[row]);
+    }
+    if (record && fclose(record) != 0) {
+        fprintf(stderr, "Failed to write %s: %s\n", record_path, strerror(errno));
+        result = -1;
+    }
+    free(steps);
+    return result;
 }
 
-static int run_monitoring_loop(Context *ctx) {
-    while (running) {
-        if (monitor_temperatures_table(ctx) != 0) return -1;
-        if (handle_input(REFRESH_DURATION * 1000)) break;
+typedef struct {
+    uint64_t records;
+    uint64_t invalid;
+    uint64_t mismatches;
+    uint32_t min_temp;
+    uint32_t max_temp;
+    double sum_delta;
+} DecodeStats;
+
+static int read_exact(FILE *f, void *buf, size_t size) {
+    return fread(buf, 1, size, f) == size ? 0 : -1;
+}
+
+/* Re-decodes a raw capture with the current REGISTERS table: prints every
+ * record as CSV on stdout and, per GPU and register, how often the current
+ * decoder disagrees with the recording on stderr. */
+static int run_decode(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return -1;
     }
 
-    printf("\033[%dB", ctx->device_count + 2);
+    unsigned char header[24];
+    if (read_exact(f, header, sizeof(header)) < 0 ||
+        memcmp(header, RAW_MAGIC, sizeof(RAW_MAGIC)) != 0 ||
+        get_u32(header + 8) != RAW_VERSION) {
+        fprintf(stderr, "%s is not a raw capture\n", path);
+        fclose(f);
+        return -1;
+    }
+
+    uint32_t gpu_count = get_u32(header + 12);
+    uint32_t register_count = get_u32(header + 16);
+    uint32_t record_size = get_u32(header + 20);
+    if (gpu_count == 0 || register_count == 0 || register_count > 8 ||
+        record_size != raw_record_size(register_count)) {
+        fprintf(stderr, "%s has an unsupported layout\n", path);
+        fclose(f);
+        return -1;
+    }
+
+    RegisterField fields[8];
+    char names[8][RAW_NAME_SIZE + 1] = {{0}};
+    const RegisterField *current[8] = {0};
+    for (uint32_t reg = 0; reg < register_count; reg++) {
+        unsigned char entry[8 + RAW_NAME_SIZE];
+        if (read_exact(f, entry, sizeof(entry)) < 0) {
+            fprintf(stderr, "%s is truncated\n", path);
+            fclose(f);
+            return -1;
+        }
+        memcpy(names[reg], entry + 8, RAW_NAME_SIZE);
+        fields[reg] = (RegisterField){names[reg], get_u32(entry), entry[4], entry[5]};
+        // Decoded temperatures are 8 bits wide, like the recorded ones, and
+        // the batch decoder saturates wider fields where its tail truncates.
+        if (fields[reg].width < 1 || fields[reg].width > 8 ||
+            fields[reg].shift + fields[reg].width > 32) {
+            fprintf(stderr, "%s has an invalid field for register %s: shift %u, width %u\n",
+                path, names[reg], fields[reg].shift, fields[reg].width);
+            fclose(f);
+            return -1;
+        }
+        for (int known = 0; known < REG_COUNT; known++) {
+            if (REGISTERS[known].offset == fields[reg].offset) current[reg] = &REGISTERS[known];
+        }
+        if (!current[reg]) {
+            fprintf(stderr, "Register %s at 0x%08X has no decoder, keeping the recorded one\n",
+                names[reg], fields[reg].offset);
+            current[reg] = &fields[reg];
+        }
+    }
+
+    DecodeStats *stats = calloc((size_t)gpu_count * register_count, sizeof(DecodeStats));
+    unsigned char *records = malloc((size_t)DECODE_BATCH * record_size);
+    uint32_t *raw = malloc((size_t)DECODE_BATCH * register_count * sizeof(uint32_t));
+    uint8_t *temps = malloc((size_t)DECODE_BATCH * register_count);
+    uint8_t *temp_valid = malloc((size_t)DECODE_BATCH * register_count);
+    // The GPU table is read rather than skipped, so a truncated one is caught.
+    int truncated = 0;
+    for (uint32_t gpu = 0; gpu < gpu_count && !truncated; gpu++) {
+        unsigned char entry[4 + RAW_BUS_ID_SIZE];
+        truncated = read_exact(f, entry, sizeof(entry)) < 0;
+    }
+    if (!stats || !records || !raw || !temps || !temp_valid || truncated) {
+        fprintf(stderr, truncated ? "%s is truncated\n" : "Failed to read %s\n", path);
+        free(stats);
+        free(records);
+        free(raw);
+        free(temps);
+        free(temp_valid);
+        fclose(f);
+        return -1;
+    }
+
+    printf("timestamp_us,gpu,core");
+    for (uint32_t reg = 0; reg < register_count; reg++)
+        printf(",%s_raw,%s_recorded,%s", names[reg], names[reg], names[reg]);
     printf("\n");
-    fflush(stdout);
-    return 0;
-}
 
-static int run_json_loop(Context *ctx) {
-    while (running) {
-        if (monitor_temperatures_json(ctx) != 0) return -1;
-        if (handle_input(REFRESH_DURATION * 1000)) break;
+    size_t count;
+    while ((count = fread(records, record_size, DECODE_BATCH, f)) > 0) {
+        // Gather each register's words into a column and decode it at once.
+        for (uint32_t reg = 0; reg < register_count; reg++) {
+            uint32_t *column = &raw[(size_t)reg * DECODE_BATCH];
+            for (size_t i = 0; i < count; i++) {
+                column[i] = get_u32(records + i * record_size +
+                    RAW_RECORD_HEADER_SIZE + reg * sizeof(uint32_t));
+            }
+            decode_register_batch(current[reg], column, &temps[(size_t)reg * DECODE_BATCH],
+                &temp_valid[(size_t)reg * DECODE_BATCH], count);
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            const unsigned char *record = records + i * record_size;
+            uint16_t gpu = get_u16(record + 8);
+            uint8_t core = record[10];
+            uint8_t valid = record[11];
+            if (gpu >= gpu_count) continue;
+
+            printf("%llu,%u,%u", (unsigned long long)get_u64(record), gpu, core);
+            for (uint32_t reg = 0; reg < register_count; reg++) {
+                size_t slot = (size_t)reg * DECODE_BATCH + i;
+                uint8_t recorded = record[RAW_RECORD_HEADER_SIZE +
+                    register_count * sizeof(uint32_t) + reg];
+                uint32_t temp = temps[slot];
+                DecodeStats *s = &stats[(size_t)gpu * register_count + reg];
+
+                printf(",0x%08X,%u,%u", raw[slot], recorded, temp);
+                if (s->records == 0 || temp < s->min_temp) s->min_temp = temp;
+                if (s->records == 0 || temp > s->max_temp) s->max_temp = temp;
+                s->records++;
+                if (!temp_valid[slot]) s->invalid++;
+                if ((valid & (1u << reg)) && temp != recorded) s->mismatches++;
+                s->sum_delta += (double)temp - core;
+            }
+            printf("\n");
+        }
+    }
+
+    for (uint32_t gpu = 0; gpu < gpu_count; gpu++) {
+        for (uint32_t reg = 0; reg < register_count; reg++) {
+            DecodeStats *s = &stats[(size_t)gpu * register_count + reg];
+            if (s->records == 0) continue;
+            fprintf(stderr, "GPU %u %-8s %llu records, %u-%u°C, %+.1f°C vs core, "
+                "%llu invalid, %llu differ from the recording\n",
+                gpu, names[reg], (unsigned long long)s->records, s->min_temp, s->max_temp,
+                s->sum_delta / s->records, (unsigned long long)s->invalid,
+                (unsigned long long)s->mismatches);
+        }
     }
+
+    free(stats);
+    free(records);
+    free(raw);
+    free(temps);
+    free(temp_valid);
+    fclose(f);
     return 0;
 }
 
 static void print_usage(const char *prog) {
     fprintf(stderr,
-        "Usage: %s [OPTIONS]\n"
+        "Usage: %s [scan | characterize] [OPTIONS]\n"
+        "       %s decode FILE\n"
         "\n"
         "Options:\n"
         "  --json           Output temperatures in JSON format\n"
         "  --once           Output temperatures once\n"
+        "  --self-stats     Add the monitor's own overhead to each JSON record\n"
+        "  --trace FILE     Write a Chrome trace of the sampling stages on exit\n"
+        "  --histograms     Keep latency histograms of hardware accesses per GPU\n"
+        "  --duration S     Run time in seconds (scan: 120, characterize: 600)\n"
+        "  --window BYTES   BAR0 window to scan (scan, default 0x40000)\n"
+        "  --record FILE    Write the samples taken after load steps as CSV (characterize)\n"
+        "  --raw FILE       Capture raw register words and NVML readings to FILE\n"
+        "  --config FILE    Read settings from FILE, and again on SIGHUP\n"
+        "  --eco            Coalesce wakeups and writes, skip runtime-suspended GPUs\n"
+        "  --queue N        JSON records to queue for a slow reader (default 16)\n"
+        "  --policy NAME    When the queue is full: drop-oldest, drop-newest, latest, block\n"
+        "  --compress gzip  Compress the output file (config key output) in the background\n"
+        "  --baseline FILE  Flag GPUs running hotter than FILE says under the same load\n"
+        "  --learn          Add the samples to the --baseline FILE instead\n"
+        "  --ecc FILE       Sample ECC and row remapping counters, keep errors per VRAM °C in FILE\n"
+        "  --pcie           Add PCIe link speed, width and AER errors, flag downtraining\n"
+        "  --sparklines     Show junction and VRAM history with trends in the table\n"
+        "  --oversample K   Load each register K times per sample and filter the loads\n"
+        "  --filter NAME    Oversampling filter: median (default) or trimmed (mean)\n"
+        "  --gpus LIST      Only sample these GPUs: indices, GPU- UUIDs, PCI bus IDs or cuda\n"
+        "  --backend NAME   nvidia (NVML and registers, default) or hwmon (amdgpu sysfs)\n"
+        "  --bench N        Time N sampling iterations per stage without output\n"
         "  --help           Show this help message and exit\n"
         "\n"
         "Examples:\n"
         "  %s                Display and update table of GPU temperatures\n"
         "  %s --json         Continuously output GPU temperatures in JSON format\n"
         "  %s --once         Output temperatures once in table format\n"
-        "  %s --json --once  Output temperatures once in JSON format\n",
-        prog, prog, prog, prog, prog);
+        "  %s --json --once  Output temperatures once in JSON format\n"
+        "  %s --bench 1000   Show where the sampling time goes, per GPU\n"
+        "  %s scan           Look for temperature registers on an unsupported card\n"
+        "  %s characterize   Fit thermal time constants and rise per watt across load steps\n"
+        "  %s decode FILE    Decode a raw capture with the current decoders\n",
+        prog, prog, prog, prog, prog, prog, prog, prog, prog, prog);
 }
 
 int main(int argc, char *argv[]) {
     Context ctx = {0};
     ctx.output_format = FORMAT_TABLE;
     ctx.output_mode = MODE_CONTINUOUS;
+    ctx.output = stdout;
+    ctx.self.syscall_fd = -1;
+    ctx.self.statm_fd = -1;
+    ctx.base = DEFAULT_CONFIG;
+    unsigned int bench_iterations = 0;
+    if (argc == 3 && strcmp(argv[1], "decode") == 0)
+        return run_decode(argv[2]) == 0 ? 0 : 1;
+
+    int scan = argc > 1 && strcmp(argv[1], "scan") == 0;
+    int characterize = argc > 1 && strcmp(argv[1], "characterize") == 0;
+    unsigned int duration = 0;
+    const char *record_path = NULL;
+    uint32_t scan_window = SCAN_WINDOW;
+    ctx.sysfs_root = getenv(SYSFS_ROOT_ENV);
+    if (!ctx.sysfs_root || !*ctx.sysfs_root) ctx.sysfs_root = SYSFS_ROOT;
 
-    for (int i = 1; i < argc; i++) {
+    for (int i = scan || characterize ? 2 : 1; i < argc; i++) {
         if (strcmp(argv[i], "--json") == 0) {
             ctx.output_format = FORMAT_JSON;
         } else if (strcmp(argv[i], "--once") == 0) {
             ctx.output_mode = MODE_ONCE;
+        } else if (strcmp(argv[i], "--self-stats") == 0) {
+            ctx.self.enabled = 1;
+        } else if (strcmp(argv[i], "--eco") == 0) {
+            ctx.eco.enabled = 1;
+        } else if (strcmp(argv[i], "--sparklines") == 0) {
+            ctx.sparklines = 1;
+        } else if (strcmp(argv[i], "--learn") == 0) {
+            ctx.baseline.learn = 1;
+        } else if (strcmp(argv[i], "--pcie") == 0) {
+            ctx.pcie_enabled = 1;
+        } else if (strcmp(argv[i], "--histograms") == 0) {
+            ctx.histograms_enabled = 1;
+        } else if (strcmp(argv[i], "--raw") == 0 && i + 1 < argc) {
+            if (set_flag(&ctx, "raw", argv[++i]) < 0) {
+                fprintf(stderr, "Invalid path: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--oversample") == 0 && i + 1 < argc) {
+            if (set_flag(&ctx, "oversample", argv[++i]) < 0) {
+                fprintf(stderr, "Invalid load count, expected 1 to %d: %s\n", OVERSAMPLE_MAX, argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            if (set_flag(&ctx, "filter", argv[++i]) < 0) {
+                fprintf(stderr, "Invalid filter, expected median or trimmed: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--queue") == 0 && i + 1 < argc) {
+            if (set_flag(&ctx, "queue", argv[++i]) < 0) {
+                fprintf(stderr, "Invalid queue size, expected 1 to %d: %s\n", QUEUE_MAX_RECORDS, argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--policy") == 0 && i + 1 < argc) {
+            if (set_flag(&ctx, "policy", argv[++i]) < 0) {
+                fprintf(stderr, "Invalid policy, expected drop-oldest, drop-newest, latest or block: %s\n",
+                    argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--compress") == 0 && i + 1 < argc) {
+            if (set_flag(&ctx, "compress", argv[++i]) < 0) {
+                fprintf(stderr, "Invalid compression, expected gzip or none: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "nvidia") == 0) {
+                ctx.backend = BACKEND_NVIDIA;
+            } else if (strcmp(argv[i], "hwmon") == 0) {
+                ctx.backend = BACKEND_HWMON;
+            } else {
+                fprintf(stderr, "Invalid backend, expected nvidia or hwmon: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            ctx.baseline.path = argv[++i];
+        } else if (strcmp(argv[i], "--ecc") == 0 && i + 1 < argc) {
+            ctx.ecc.path = argv[++i];
+        } else if (strcmp(argv[i], "--gpus") == 0 && i + 1 < argc) {
+            ctx.gpu_selection = argv[++i];
+        } else if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+            ctx.config_path = argv[++i];
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            ctx.trace_path = argv[++i];
+        } else if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc) {
+            char *end;
+            unsigned long value = strtoul(argv[++i], &end, 10);
+            if (*end || value == 0 || value > UINT32_MAX) {
+                fprintf(stderr, "Invalid iteration count: %s\n", argv[i]);
+                return 1;
+            }
+            bench_iterations = (unsigned int)value;
+        } else if (strcmp(argv[i], "--duration") == 0 && i + 1 < argc) {
+            char *end;
+            unsigned long value = strtoul(argv[++i], &end, 10);
+            if (*end || value == 0 || value > UINT32_MAX) {
+                fprintf(stderr, "Invalid duration: %s\n", argv[i]);
+                return 1;
+            }
+            duration = (unsigned int)value;
+        } else if (strcmp(argv[i], "--window") == 0 && i + 1 < argc) {
+            char *end;
+            unsigned long value = strtoul(argv[++i], &end, 0);
+            if (*end || value < 32 || value > SCAN_MAX_WINDOW || value % 32) {
+                fprintf(stderr, "Invalid window, expected a multiple of 32 up to 0x%X: %s\n",
+                    SCAN_MAX_WINDOW, argv[i]);
+                return 1;
+            }
+            scan_window = (uint32_t)value;
         } else if (strcmp(argv[i], "--help") == 0) {
             print_usage(argv[0]);
             return 0;
@@ -395,7 +5218,44 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    if (ctx.output_format == FORMAT_TABLE && ctx.output_mode == MODE_CONTINUOUS) {
+    if (record_path && !characterize) {
+        fprintf(stderr, "--record needs characterize\n");
+        return 1;
+    }
+    if (ctx.baseline.learn && !ctx.baseline.path) {
+        fprintf(stderr, "--learn needs --baseline FILE\n");
+        return 1;
+    }
+    if (ctx.baseline.path && !ctx.baseline.learn && ctx.output_format != FORMAT_JSON) {
+        fprintf(stderr, "Comparing with a baseline needs --json\n");
+        return 1;
+    }
+    if (ctx.pcie_enabled && ctx.output_format != FORMAT_JSON) {
+        fprintf(stderr, "--pcie needs --json\n");
+        return 1;
+    }
+
+    ctx.config = ctx.base;
+    if (ctx.config_path && load_config(&ctx, &ctx.config) < 0)
+        return 1;
+
+    // After the config file, which can set a raw capture too.
+    if (ctx.backend == BACKEND_HWMON &&
+        (scan || characterize || ctx.config.raw_path[0] || ctx.baseline.path || ctx.ecc.path)) {
+        fprintf(stderr, "%s needs the nvidia backend\n", scan ? "scan" : characterize ? "characterize" :
+            ctx.baseline.path ? "--baseline" : ctx.ecc.path ? "--ecc" : "--raw");
+        return 1;
+    }
+
+    if (ctx.config.compress != COMPRESS_NONE &&
+        (ctx.output_format != FORMAT_JSON || !ctx.config.output_path[0] || bench_iterations || scan ||
+         characterize)) {
+        fprintf(stderr, "Compression needs --json and an output file\n");
+        return 1;
+    }
+
+    if (ctx.output_format == FORMAT_TABLE && ctx.output_mode == MODE_CONTINUOUS &&
+        bench_iterations == 0 && !scan && !characterize) {
         if (setup_terminal() < 0) {
             cleanup_context(&ctx);
             return 1;
@@ -411,7 +5271,13 @@ int main(int argc, char *argv[]) {
     }
 
     int result;
-    if (ctx.output_format == FORMAT_JSON && ctx.output_mode == MODE_CONTINUOUS) {
+    if (scan) {
+        result = run_scan(&ctx, scan_window, duration ? duration : SCAN_DURATION);
+    } else if (characterize) {
+        result = run_characterize(&ctx, duration ? duration : STEP_DURATION, record_path);
+    } else if (bench_iterations > 0) {
+        result = run_bench(&ctx, bench_iterations);
+    } else if (ctx.output_format == FORMAT_JSON && ctx.output_mode == MODE_CONTINUOUS) {
         result = run_json_loop(&ctx);
     } else if (ctx.output_format == FORMAT_JSON && ctx.output_mode == MODE_ONCE) {
         result = monitor_temperatures_json(&ctx);
@@ -421,6 +5287,11 @@ int main(int argc, char *argv[]) {
         result = monitor_temperatures_table(&ctx);
         printf("\033[%dB\n", ctx.device_count + 2);
     }
+    if (ctx.baseline.learn && save_baseline(&ctx) < 0) result = -1;
+    if (ctx.ecc.rows) {
+        dump_ecc(&ctx);
+        if (save_ecc(&ctx) < 0) result = -1;
+    }
 
     cleanup_context(&ctx);
     return result == 0 ? 0 : 1;
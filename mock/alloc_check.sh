@@ -0,0 +1,35 @@
+#!/bin/sh
+# Runs gputemps on the mock for a while under mock/alloc_count.c, built in a
+# temporary directory, and fails if it allocates heap memory once it is
+# sampling. A second run loses a GPU halfway. Extra arguments are passed to
+# gputemps; the mock runs 10 times faster than real time.
+#
+# Usage:
+#   mock/alloc_check.sh [SECONDS] [OPTIONS]
+#   mock/alloc_check.sh 600 --json --self-stats --histograms --oversample 8
+
+set -eu
+
+cd "$(dirname "$0")/.."
+seconds=${1:-60}
+[ $# -gt 0 ] && shift
+[ $# -gt 0 ] || set -- --json
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+gcc -shared -fPIC -O2 mock/alloc_count.c -o "$dir/alloc_count.so" -ldl
+echo "interval_ms = 10" > "$dir/gputemps.conf"
+
+run() {
+    GPUTEMPS_MOCK_GPUS=${GPUTEMPS_MOCK_GPUS:-4} GPUTEMPS_MOCK_SPEED=${GPUTEMPS_MOCK_SPEED:-10} \
+    LD_LIBRARY_PATH=mock${LD_LIBRARY_PATH:+:$LD_LIBRARY_PATH} LD_PRELOAD="$dir/alloc_count.so" \
+        timeout --preserve-status -s INT "$seconds" ./gputemps --config "$dir/gputemps.conf" "$@" > /dev/null
+}
+
+run "$@"
+
+# GPU 1 falls off the bus halfway and stays away: losing a GPU and the
+# indices shifting must not allocate either. A GPU that appears or comes
+# back does, see the README.
+echo "alloc_count: GPU 1 lost after $((seconds / 2)) s"
+GPUTEMPS_MOCK_DROP=1:$((seconds / 2)):$((seconds + 1)) run "$@"
@@ -0,0 +1,109 @@
+/*
+ * LD_PRELOAD shim that counts the heap allocations gputemps makes once it is
+ * sampling, to check that the steady state never allocates. The first call
+ * to select(), i.e. the first sleep after the first sample, arms it. On exit
+ * it prints how many allocations it saw and where they came from, and turns
+ * the exit status into 1 if there were any.
+ *
+ * Allocations made by the process as a whole are counted, including those of
+ * the NVML library, so with the real libnvidia-ml the result also depends on
+ * the driver.
+ *
+ * Build and run (see also mock/alloc_check.sh):
+ *   gcc -shared -fPIC -O2 mock/alloc_count.c -o mock/alloc_count.so -ldl
+ *   LD_PRELOAD=mock/alloc_count.so LD_LIBRARY_PATH=mock ./gputemps --json
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/select.h>
+#include <unistd.h>
+
+#define MAX_CALLERS 16
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+static atomic_int armed;
+static atomic_ulong allocations;
+static void *callers[MAX_CALLERS];
+static unsigned long caller_counts[MAX_CALLERS];
+static atomic_flag callers_lock = ATOMIC_FLAG_INIT;
+
+static void count(void *caller) {
+    if (!atomic_load_explicit(&armed, memory_order_relaxed)) return;
+    atomic_fetch_add(&allocations, 1);
+
+    while (atomic_flag_test_and_set(&callers_lock)) {}
+    for (int i = 0; i < MAX_CALLERS; i++) {
+        if (callers[i] && callers[i] != caller) continue;
+        callers[i] = caller;
+        caller_counts[i]++;
+        break;
+    }
+    atomic_flag_clear(&callers_lock);
+}
+
+void *malloc(size_t size) {
+    count(__builtin_return_address(0));
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count_, size_t size) {
+    count(__builtin_return_address(0));
+    return __libc_calloc(count_, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    count(__builtin_return_address(0));
+    return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size) {
+    count(__builtin_return_address(0));
+    return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    count(__builtin_return_address(0));
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) {
+    count(__builtin_return_address(0));
+    *ptr = __libc_memalign(alignment, size);
+    return *ptr ? 0 : 12;
+}
+
+int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
+           struct timeval *timeout) {
+    static int (*next)(int, fd_set *, fd_set *, fd_set *, struct timeval *);
+    if (!next) next = (int (*)(int, fd_set *, fd_set *, fd_set *, struct timeval *))dlsym(RTLD_NEXT, "select");
+    atomic_store(&armed, 1);
+    return next(nfds, readfds, writefds, exceptfds, timeout);
+}
+
+__attribute__((destructor))
+static void report(void) {
+    atomic_store(&armed, 0);
+    unsigned long total = atomic_load(&allocations);
+    fprintf(stderr, "alloc_count: %lu allocations after startup\n", total);
+    for (int i = 0; i < MAX_CALLERS && callers[i]; i++) {
+        // info is left unset when dladdr() finds no object for the address.
+        Dl_info info;
+        if (!dladdr(callers[i], &info)) {
+            fprintf(stderr, "  %6lu from %p\n", caller_counts[i], callers[i]);
+        } else if (info.dli_sname) {
+            fprintf(stderr, "  %6lu from %s+0x%lx (%s)\n", caller_counts[i], info.dli_sname,
+                (unsigned long)((char *)callers[i] - (char *)info.dli_saddr), info.dli_fname);
+        } else {
+            fprintf(stderr, "  %6lu from %p (%s)\n", caller_counts[i], callers[i],
+                info.dli_fname ? info.dli_fname : "?");
+        }
+    }
+    if (total) _exit(1);
+}
@@ -0,0 +1,78 @@
+#!/bin/sh
+# Runs ./gputemps decode on hand-made raw captures and fails unless it decodes
+# every record the same way whatever its position in a batch, and refuses
+# fields wider than the 8-bit temperatures. The record count is not a
+# multiple of any vector width, so the scalar tail is checked as well.
+#
+# Usage:
+#   mock/decode_check.sh
+
+set -eu
+
+cd "$(dirname "$0")/.."
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+failed=0
+records=37
+
+# Little-endian integers as raw bytes.
+bytes() {
+    value=$1
+    count=$2
+    while [ "$count" -gt 0 ]; do
+        printf "\\$(printf %03o $((value & 255)))"
+        value=$((value >> 8))
+        count=$((count - 1))
+    done
+}
+
+# One GPU and one register at an offset the REGISTERS table does not know,
+# so the recorded shift and width are used.
+capture() {
+    shift_bits=$1
+    width=$2
+    mask=$(((1 << width) - 1))
+    {
+        printf 'GPUTRAW\0'
+        bytes 1 4; bytes 1 4; bytes 1 4; bytes 17 4
+        bytes 0x1234 4; bytes "$shift_bits" 1; bytes "$width" 1; bytes 0 2
+        printf 'test\0\0\0\0'
+        bytes 0x2684 4; printf '0000:01:00.0\0\0\0\0'
+        i=0
+        while [ $i -lt $records ]; do
+            raw=$(((i * 2654435761) & 0xFFFFFFFF))
+            bytes $((1000000 + i)) 8; bytes 0 2; bytes 40 1; bytes 1 1
+            bytes $raw 4; bytes $(((raw >> shift_bits) & mask)) 1
+            i=$((i + 1))
+        done
+    } > "$dir/capture.bin"
+}
+
+check() {
+    name=$1
+    expected=$2
+    actual=$3
+    if [ "$actual" = "$expected" ]; then
+        echo "ok: $name"
+    else
+        echo "FAILED: $name"
+        echo "  expected: $expected"
+        echo "  actual:   $actual"
+        failed=1
+    fi
+}
+
+# Columns: timestamp_us, gpu, core, test_raw, test_recorded, test.
+capture 4 8
+check "decodes every record like the recording" "$records records, 0 differ" \
+    "$(./gputemps decode "$dir/capture.bin" 2>/dev/null |
+        awk -F, 'NR > 1 { n++; if ($5 != $6) d++ } END { printf "%d records, %d differ", n, d }')"
+
+capture 4 9
+check "refuses a 9-bit field" \
+    "$dir/capture.bin has an invalid field for register test: shift 4, width 9" \
+    "$(./gputemps decode "$dir/capture.bin" 2>&1)"
+
+exit $failed
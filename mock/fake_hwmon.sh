@@ -0,0 +1,45 @@
+#!/bin/sh
+# Creates a fake sysfs tree with amdgpu hwmon nodes for `--backend hwmon`,
+# plus a CPU sensor that gputemps must skip. Temperatures are static; write
+# new millidegree values to the tempN_input files to change them. Each card
+# also gets the PCIe link and AER files read by --pcie under bus/pci/devices.
+#
+# Usage:
+#   mock/fake_hwmon.sh DIR [GPUS]
+#   GPUTEMPS_SYSFS_ROOT=DIR ./gputemps --backend hwmon
+
+set -eu
+
+root=${1:?usage: $0 DIR [GPUS]}
+gpus=${2:-2}
+
+mkdir -p "$root/class/hwmon" "$root/devices/pci0000:00" "$root/bus/pci/devices"
+
+cpu="$root/class/hwmon/hwmon0"
+mkdir -p "$cpu"
+echo k10temp > "$cpu/name"
+echo Tctl > "$cpu/temp1_label"
+echo 45000 > "$cpu/temp1_input"
+
+i=0
+while [ "$i" -lt "$gpus" ]; do
+    bus=$(printf '0000:%02x:00.0' $((i + 3)))
+    node="$root/class/hwmon/hwmon$((i + 1))"
+    mkdir -p "$node" "$root/devices/pci0000:00/$bus"
+    ln -sfn "../../../devices/pci0000:00/$bus" "$node/device"
+    ln -sfn "../../../devices/pci0000:00/$bus" "$root/bus/pci/devices/$bus"
+    echo amdgpu > "$node/name"
+    echo edge > "$node/temp1_label"
+    echo junction > "$node/temp2_label"
+    echo mem > "$node/temp3_label"
+    echo $((40000 + i * 1000)) > "$node/temp1_input"
+    echo $((48000 + i * 1000)) > "$node/temp2_input"
+    echo $((52000 + i * 1000)) > "$node/temp3_input"
+    dev="$root/devices/pci0000:00/$bus"
+    echo "16.0 GT/s PCIe" | tee "$dev/current_link_speed" > "$dev/max_link_speed"
+    echo 16 | tee "$dev/current_link_width" > "$dev/max_link_width"
+    printf 'RxErr 0\nBadTLP 0\nTOTAL_ERR_COR 0\n' > "$dev/aer_dev_correctable"
+    printf 'DLP 0\nTOTAL_ERR_NONFATAL 0\n' > "$dev/aer_dev_nonfatal"
+    printf 'DLP 0\nTOTAL_ERR_FATAL 0\n' > "$dev/aer_dev_fatal"
+    i=$((i + 1))
+done
@@ -0,0 +1,63 @@
+#!/bin/sh
+# Runs ./gputemps --backend hwmon on a fake sysfs tree from mock/fake_hwmon.sh
+# and fails unless it reads the expected temperatures, skips the CPU sensor,
+# follows changes, selects GPUs by bus ID and never needs NVML.
+#
+# Usage:
+#   mock/hwmon_check.sh
+
+set -eu
+
+cd "$(dirname "$0")/.."
+
+root=$(mktemp -d)
+trap 'rm -rf "$root"' EXIT
+mock/fake_hwmon.sh "$root" 2
+
+failed=0
+check() {
+    name=$1
+    expected=$2
+    shift 2
+    actual=$(GPUTEMPS_SYSFS_ROOT="$root" ./gputemps --backend hwmon "$@" 2>&1 |
+        sed 's/"timestamp":[0-9]*,//')
+    if [ "$actual" = "$expected" ]; then
+        echo "ok: $name"
+    else
+        echo "FAILED: $name"
+        echo "  expected: $expected"
+        echo "  actual:   $actual"
+        failed=1
+    fi
+}
+
+# NVML is loaded with dlopen() by the nvidia backend only, so a binary that
+# links it would not start on a host without the NVIDIA driver.
+if ldd ./gputemps | grep -q libnvidia-ml; then
+    echo "FAILED: ./gputemps links libnvidia-ml"
+    failed=1
+fi
+
+check "reads every card, skips the CPU" \
+    '{"gpus":[{"index":0,"core":40,"junction":48,"vram":52},{"index":1,"core":41,"junction":49,"vram":53}]}' \
+    --json --once
+
+echo 91000 > "$root/class/hwmon/hwmon2/temp2_input"
+check "follows sensor changes" \
+    '{"gpus":[{"index":0,"core":40,"junction":48,"vram":52},{"index":1,"core":41,"junction":91,"vram":53}]}' \
+    --json --once
+
+check "selects GPUs by bus ID" \
+    '{"gpus":[{"index":1,"core":41,"junction":91,"vram":53}]}' \
+    --json --once --gpus 0000:04:00.0
+
+check "refuses NVIDIA-only options" \
+    '--raw needs the nvidia backend' \
+    --json --once --raw /dev/null
+
+echo "raw = $root/capture.bin" > "$root/raw.conf"
+check "refuses a raw capture from the config file" \
+    '--raw needs the nvidia backend' \
+    --json --once --config "$root/raw.conf"
+
+exit $failed
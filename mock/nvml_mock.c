@@ -0,0 +1,571 @@
+/*
+ * Stand-in for libnvidia-ml.so.1 that simulates GPUs, so gputemps can be run,
+ * tested and benchmarked on machines without an NVIDIA GPU.
+ *
+ * On load, the library creates a sparse file acting as the BAR0 space of every
+ * simulated GPU and a libpci dump describing them, then exports
+ * GPUTEMPS_MEM_PATH and GPUTEMPS_PCI_DUMP so gputemps picks both up. The
+ * temperatures come from a first-order thermal model driven by a load profile,
+ * advanced lazily whenever a device is queried.
+ *
+ * Configuration (environment):
+ *   GPUTEMPS_MOCK_GPUS       number of simulated GPUs (default 2)
+ *   GPUTEMPS_MOCK_PROFILE    idle, full, square, sine or ramp (default square)
+ *   GPUTEMPS_MOCK_PERIOD     load profile period in seconds (default 60)
+ *   GPUTEMPS_MOCK_TAU_HEAT   heating time constant in seconds (default 8)
+ *   GPUTEMPS_MOCK_TAU_COOL   cooling time constant in seconds (default 20)
+ *   GPUTEMPS_MOCK_NOISE      sensor noise standard deviation in °C (default 0.5)
+ *   GPUTEMPS_MOCK_AMBIENT    ambient temperature in °C (default 30)
+ *   GPUTEMPS_MOCK_RESISTANCE scale of the thermal resistances (default 1), e.g.
+ *                            1.1 for a GPU that runs hotter after a repaste
+ *   GPUTEMPS_MOCK_ECC_RATE   corrected ECC errors per hour at a VRAM temperature
+ *                            of 60°C, doubling every 10°C; one row is remapped
+ *                            per 64 errors (default none: ECC not supported)
+ *   GPUTEMPS_MOCK_SPEED      simulated seconds per real second (default 1)
+ *   GPUTEMPS_MOCK_LATENCY_US added latency of every NVML call (default 0)
+ *   GPUTEMPS_MOCK_SEED       noise seed (default 1)
+ *   GPUTEMPS_MOCK_DIR        directory for the generated files (default /dev/shm)
+ *   GPUTEMPS_MOCK_DROP       GPU:FROM:TO, the GPU falls off the bus from FROM to
+ *                            TO seconds after start (default none)
+ *
+ * Build:
+ *   gcc -shared -fPIC -O2 mock/nvml_mock.c -o mock/libnvidia-ml.so.1 \
+ *     -Wl,-soname,libnvidia-ml.so.1 -lm -lpthread -I/path/to/cuda/include
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <nvml.h>
+
+#define MOCK_BAR_WINDOW 0x00040000
+#define MOCK_BAR_TAIL 0x01000000
+#define MOCK_HOTSPOT_OFFSET 0x0002046C
+#define MOCK_VRAM_OFFSET 0x0000E2A8
+#define MOCK_VENDOR_ID 0x10de
+#define MOCK_DEVICE_ID 0x2204
+#define MOCK_IDLE_POWER 30.0
+#define MOCK_MAX_POWER 350.0
+#define MOCK_MAX_STEP 0.05
+#define MOCK_ECC_TEMP 60.0
+#define MOCK_ECC_DOUBLING 10.0
+#define MOCK_ECC_PER_ROW 64
+
+typedef enum {
+    PROFILE_IDLE,
+    PROFILE_FULL,
+    PROFILE_SQUARE,
+    PROFILE_SINE,
+    PROFILE_RAMP
+} LoadProfile;
+
+struct nvmlDevice_st {
+    unsigned int index;
+    unsigned int domain;
+    unsigned int bus;
+    double phase;
+    double r_core;
+    double r_junction;
+    double r_vram;
+    double core;
+    double junction;
+    double vram;
+    double load;
+    double power;
+    double ecc_errors;
+    double last_update;
+    uint64_t rng;
+    unsigned int core_reading;
+    char uuid[48];
+};
+
+typedef struct {
+    unsigned int count;
+    LoadProfile profile;
+    double period;
+    double tau_heat;
+    double tau_cool;
+    double noise;
+    double ambient;
+    double resistance;
+    double ecc_rate;
+    double speed;
+    long latency_us;
+    uint64_t seed;
+    unsigned int drop_gpu;
+    double drop_from;
+    double drop_to;
+    char dir[512];
+    char bar_path[600];
+    char dump_path[600];
+    int created;
+    uint8_t *bar;
+    size_t bar_size;
+    double start;
+    int initialized;
+    struct nvmlDevice_st *devices;
+    pthread_mutex_t lock;
+} MockState;
+
+static MockState mock = {
+    .lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+static double env_double(const char *name, double fallback) {
+    const char *value = getenv(name);
+    if (!value || !*value) return fallback;
+    char *end;
+    double parsed = strtod(value, &end);
+    return *end ? fallback : parsed;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double sim_seconds(void) {
+    return (now_seconds() - mock.start) * mock.speed;
+}
+
+/* A dropped GPU disappears from enumeration, so the NVML indices of the GPUs
+ * after it shift down, and its old handles report GPU_IS_LOST. */
+static int device_present(const struct nvmlDevice_st *dev) {
+    if (dev->index != mock.drop_gpu) return 1;
+    double t = now_seconds() - mock.start;
+    return t < mock.drop_from || t >= mock.drop_to;
+}
+
+static struct nvmlDevice_st *visible_device(unsigned int index) {
+    for (unsigned int i = 0; i < mock.count; i++) {
+        if (device_present(&mock.devices[i]) && index-- == 0) return &mock.devices[i];
+    }
+    return NULL;
+}
+
+static uint64_t next_random(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static double gaussian(uint64_t *state) {
+    double u1 = ((next_random(state) >> 11) + 1.0) / 9007199254740993.0;
+    double u2 = (next_random(state) >> 11) / 9007199254740992.0;
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+static LoadProfile parse_profile(const char *name) {
+    if (!name || !*name) return PROFILE_SQUARE;
+    if (strcmp(name, "idle") == 0) return PROFILE_IDLE;
+    if (strcmp(name, "full") == 0) return PROFILE_FULL;
+    if (strcmp(name, "sine") == 0) return PROFILE_SINE;
+    if (strcmp(name, "ramp") == 0) return PROFILE_RAMP;
+    if (strcmp(name, "square") != 0)
+        fprintf(stderr, "nvml_mock: unknown profile '%s', using square\n", name);
+    return PROFILE_SQUARE;
+}
+
+static double profile_load(double t) {
+    double cycle = fmod(t / mock.period, 1.0);
+    switch (mock.profile) {
+        case PROFILE_IDLE: return 0.0;
+        case PROFILE_FULL: return 1.0;
+        case PROFILE_SINE: return 0.5 - 0.5 * cos(2.0 * M_PI * cycle);
+        case PROFILE_RAMP: return cycle;
+        default: return cycle < 0.5 ? 1.0 : 0.0;
+    }
+}
+
+static double approach(double current, double target, double tau, double dt) {
+    return target + (current - target) * exp(-dt / tau);
+}
+
+static unsigned int sensor_value(struct nvmlDevice_st *dev, double temp) {
+    double noisy = temp + mock.noise * gaussian(&dev->rng);
+    if (noisy < 0) noisy = 0;
+    if (noisy > 126) noisy = 126;
+    return (unsigned int)lround(noisy);
+}
+
+static void write_register(unsigned int index, uint32_t offset, uint32_t value) {
+    volatile uint32_t *reg = (volatile uint32_t *)
+        (mock.bar + (size_t)(index + 1) * MOCK_BAR_WINDOW + offset);
+    *reg = value;
+}
+
+/* Advances the thermal model of a device to the current simulated time and
+ * publishes the resulting sensor values to its registers. */
+static void update_device(struct nvmlDevice_st *dev) {
+    double t = sim_seconds();
+
+    while (dev->last_update < t) {
+        double dt = t - dev->last_update;
+        if (dt > MOCK_MAX_STEP) dt = MOCK_MAX_STEP;
+        dev->last_update += dt;
+        dev->load = profile_load(dev->last_update + dev->phase);
+
+        double power = MOCK_IDLE_POWER + dev->load * (MOCK_MAX_POWER - MOCK_IDLE_POWER);
+        double core_target = mock.ambient + power * dev->r_core * mock.resistance;
+        double junction_target = core_target + power * dev->r_junction * mock.resistance;
+        double vram_target = mock.ambient + power * dev->r_vram * mock.resistance;
+        dev->power = power;
+
+        dev->core = approach(dev->core, core_target,
+            core_target > dev->core ? mock.tau_heat : mock.tau_cool, dt);
+        dev->junction = approach(dev->junction, junction_target,
+            junction_target > dev->junction ? mock.tau_heat : mock.tau_cool, dt);
+        dev->vram = approach(dev->vram, vram_target,
+            2.0 * (vram_target > dev->vram ? mock.tau_heat : mock.tau_cool), dt);
+        dev->ecc_errors += mock.ecc_rate / 3600 * dt *
+            pow(2, (dev->vram - MOCK_ECC_TEMP) / MOCK_ECC_DOUBLING);
+    }
+
+    uint32_t noise_bits = (uint32_t)next_random(&dev->rng);
+    dev->core_reading = sensor_value(dev, dev->core);
+    write_register(dev->index, MOCK_HOTSPOT_OFFSET,
+        (noise_bits & 0xffff00ff) | (sensor_value(dev, dev->junction) << 8));
+    write_register(dev->index, MOCK_VRAM_OFFSET,
+        (noise_bits & 0xfffff000) | (sensor_value(dev, dev->vram) * 0x20));
+}
+
+static void simulate_latency(void) {
+    if (mock.latency_us <= 0) return;
+    struct timespec ts = {mock.latency_us / 1000000, (mock.latency_us % 1000000) * 1000};
+    nanosleep(&ts, NULL);
+}
+
+static int write_pci_dump(void) {
+    FILE *f = fopen(mock.dump_path, "w");
+    if (!f) return -1;
+
+    for (unsigned int i = 0; i < mock.count; i++) {
+        struct nvmlDevice_st *dev = &mock.devices[i];
+        uint8_t config[64] = {0};
+        uint32_t bar0 = (i + 1) * MOCK_BAR_WINDOW;
+
+        config[0x00] = MOCK_VENDOR_ID & 0xff;
+        config[0x01] = MOCK_VENDOR_ID >> 8;
+        config[0x02] = MOCK_DEVICE_ID & 0xff;
+        config[0x03] = MOCK_DEVICE_ID >> 8;
+        config[0x0a] = 0x00;
+        config[0x0b] = 0x03;
+        memcpy(&config[0x10], &bar0, sizeof(bar0));
+
+        fprintf(f, "%04x:%02x:00.0 VGA compatible controller: Simulated GPU %u\n",
+            dev->domain, dev->bus, i);
+        for (unsigned int row = 0; row < sizeof(config); row += 16) {
+            fprintf(f, "%02x:", row);
+            for (unsigned int col = 0; col < 16; col++)
+                fprintf(f, " %02x", config[row + col]);
+            fprintf(f, "\n");
+        }
+        fprintf(f, "\n");
+    }
+
+    return fclose(f);
+}
+
+static int create_bar_file(void) {
+    int fd = open(mock.bar_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) return -1;
+
+    // The tail leaves room for scans past the last simulated window.
+    mock.bar_size = (size_t)(mock.count + 1) * MOCK_BAR_WINDOW + MOCK_BAR_TAIL;
+    if (ftruncate(fd, mock.bar_size) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    mock.bar = mmap(NULL, mock.bar_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mock.bar == MAP_FAILED) {
+        mock.bar = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+__attribute__((constructor))
+static void mock_setup(void) {
+    mock.count = (unsigned int)env_double("GPUTEMPS_MOCK_GPUS", 2);
+    mock.profile = parse_profile(getenv("GPUTEMPS_MOCK_PROFILE"));
+    mock.period = env_double("GPUTEMPS_MOCK_PERIOD", 60);
+    mock.tau_heat = env_double("GPUTEMPS_MOCK_TAU_HEAT", 8);
+    mock.tau_cool = env_double("GPUTEMPS_MOCK_TAU_COOL", 20);
+    mock.noise = env_double("GPUTEMPS_MOCK_NOISE", 0.5);
+    mock.ambient = env_double("GPUTEMPS_MOCK_AMBIENT", 30);
+    mock.resistance = env_double("GPUTEMPS_MOCK_RESISTANCE", 1);
+    mock.ecc_rate = env_double("GPUTEMPS_MOCK_ECC_RATE", -1);
+    mock.speed = env_double("GPUTEMPS_MOCK_SPEED", 1);
+    mock.latency_us = (long)env_double("GPUTEMPS_MOCK_LATENCY_US", 0);
+    mock.seed = (uint64_t)env_double("GPUTEMPS_MOCK_SEED", 1);
+    if (mock.period <= 0) mock.period = 60;
+    if (mock.tau_heat <= 0) mock.tau_heat = 8;
+    if (mock.tau_cool <= 0) mock.tau_cool = 20;
+    if (mock.speed <= 0) mock.speed = 1;
+    if (mock.resistance <= 0) mock.resistance = 1;
+    mock.drop_gpu = UINT32_MAX;
+    const char *drop = getenv("GPUTEMPS_MOCK_DROP");
+    if (drop && sscanf(drop, "%u:%lf:%lf", &mock.drop_gpu, &mock.drop_from, &mock.drop_to) != 3) {
+        fprintf(stderr, "nvml_mock: invalid GPUTEMPS_MOCK_DROP '%s', expected GPU:FROM:TO\n", drop);
+        mock.drop_gpu = UINT32_MAX;
+    }
+
+    const char *dir = getenv("GPUTEMPS_MOCK_DIR");
+    snprintf(mock.dir, sizeof(mock.dir), "%s", dir && *dir ? dir : "/dev/shm");
+    snprintf(mock.bar_path, sizeof(mock.bar_path), "%s/gputemps-mock-%d.bar",
+        mock.dir, (int)getpid());
+    snprintf(mock.dump_path, sizeof(mock.dump_path), "%s/gputemps-mock-%d.pci",
+        mock.dir, (int)getpid());
+
+    mock.devices = calloc(mock.count ? mock.count : 1, sizeof(*mock.devices));
+    if (!mock.devices) return;
+
+    uint64_t rng = mock.seed ? mock.seed : 1;
+    for (unsigned int i = 0; i < mock.count; i++) {
+        struct nvmlDevice_st *dev = &mock.devices[i];
+        dev->index = i;
+        dev->domain = i / 255;
+        dev->bus = i % 255 + 1;
+        snprintf(dev->uuid, sizeof(dev->uuid), "GPU-%08x-0000-4000-8000-%012x",
+            (unsigned int)(mock.seed ^ 0x6d6f636b), i);
+        dev->phase = mock.count > 1 ? mock.period * i / mock.count : 0;
+        dev->r_core = 0.13 * (0.9 + 0.2 * (next_random(&rng) % 1000) / 1000.0);
+        dev->r_junction = 0.04 * (0.9 + 0.2 * (next_random(&rng) % 1000) / 1000.0);
+        dev->r_vram = 0.17 * (0.9 + 0.2 * (next_random(&rng) % 1000) / 1000.0);
+        dev->core = dev->junction = dev->vram = mock.ambient;
+        dev->rng = next_random(&rng) | 1;
+    }
+
+    if (create_bar_file() < 0 || write_pci_dump() < 0) {
+        fprintf(stderr, "nvml_mock: failed to create simulated devices in %s\n", mock.dir);
+        return;
+    }
+    mock.created = 1;
+    mock.start = now_seconds();
+
+    setenv("GPUTEMPS_MEM_PATH", mock.bar_path, 0);
+    setenv("GPUTEMPS_PCI_DUMP", mock.dump_path, 0);
+}
+
+__attribute__((destructor))
+static void mock_teardown(void) {
+    if (mock.bar) munmap(mock.bar, mock.bar_size);
+    if (mock.created) {
+        unlink(mock.bar_path);
+        unlink(mock.dump_path);
+    }
+    free(mock.devices);
+}
+
+static nvmlReturn_t lookup(nvmlDevice_t device) {
+    if (!mock.initialized) return NVML_ERROR_UNINITIALIZED;
+    if (!device || device < mock.devices || device >= mock.devices + mock.count)
+        return NVML_ERROR_INVALID_ARGUMENT;
+    simulate_latency();
+    return device_present(device) ? NVML_SUCCESS : NVML_ERROR_GPU_IS_LOST;
+}
+
+nvmlReturn_t nvmlInit(void) {
+    if (!mock.created) return NVML_ERROR_UNKNOWN;
+    mock.initialized = 1;
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlShutdown(void) {
+    if (!mock.initialized) return NVML_ERROR_UNINITIALIZED;
+    mock.initialized = 0;
+    return NVML_SUCCESS;
+}
+
+const char *nvmlErrorString(nvmlReturn_t result) {
+    switch (result) {
+        case NVML_SUCCESS: return "Success";
+        case NVML_ERROR_UNINITIALIZED: return "Uninitialized";
+        case NVML_ERROR_INVALID_ARGUMENT: return "Invalid Argument";
+        case NVML_ERROR_NOT_SUPPORTED: return "Not Supported";
+        case NVML_ERROR_NOT_FOUND: return "Not Found";
+        case NVML_ERROR_GPU_IS_LOST: return "GPU is lost";
+        default: return "Unknown Error";
+    }
+}
+
+nvmlReturn_t nvmlDeviceGetCount(unsigned int *count) {
+    if (!mock.initialized) return NVML_ERROR_UNINITIALIZED;
+    if (!count) return NVML_ERROR_INVALID_ARGUMENT;
+    simulate_latency();
+    *count = 0;
+    for (unsigned int i = 0; i < mock.count; i++) *count += device_present(&mock.devices[i]);
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetHandleByIndex(unsigned int index, nvmlDevice_t *device) {
+    if (!mock.initialized) return NVML_ERROR_UNINITIALIZED;
+    if (!device) return NVML_ERROR_INVALID_ARGUMENT;
+    simulate_latency();
+    *device = visible_device(index);
+    return *device ? NVML_SUCCESS : NVML_ERROR_INVALID_ARGUMENT;
+}
+
+nvmlReturn_t nvmlDeviceGetPciInfo(nvmlDevice_t device, nvmlPciInfo_t *pci) {
+    nvmlReturn_t result = lookup(device);
+    if (result != NVML_SUCCESS) return result;
+    if (!pci) return NVML_ERROR_INVALID_ARGUMENT;
+
+    memset(pci, 0, sizeof(*pci));
+    pci->domain = device->domain;
+    pci->bus = device->bus;
+    pci->device = 0;
+    pci->pciDeviceId = (MOCK_DEVICE_ID << 16) | MOCK_VENDOR_ID;
+    snprintf(pci->busId, sizeof(pci->busId), "%08X:%02X:00.0", device->domain, device->bus);
+    snprintf(pci->busIdLegacy, sizeof(pci->busIdLegacy), "%04X:%02X:00.0",
+        device->domain, device->bus);
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetHandleByUUID(const char *uuid, nvmlDevice_t *device) {
+    if (!mock.initialized) return NVML_ERROR_UNINITIALIZED;
+    if (!uuid || !device) return NVML_ERROR_INVALID_ARGUMENT;
+    simulate_latency();
+    for (unsigned int i = 0; i < mock.count; i++) {
+        if (strcasecmp(mock.devices[i].uuid, uuid) == 0 && device_present(&mock.devices[i])) {
+            *device = &mock.devices[i];
+            return NVML_SUCCESS;
+        }
+    }
+    return NVML_ERROR_NOT_FOUND;
+}
+
+/* Accepts domain:bus:device.function and bus:device.function, like NVML. */
+nvmlReturn_t nvmlDeviceGetHandleByPciBusId(const char *bus_id, nvmlDevice_t *device) {
+    unsigned int domain = 0, bus, slot, function;
+    if (!mock.initialized) return NVML_ERROR_UNINITIALIZED;
+    if (!bus_id || !device) return NVML_ERROR_INVALID_ARGUMENT;
+    if (sscanf(bus_id, "%x:%x:%x.%x", &domain, &bus, &slot, &function) != 4 &&
+        (domain = 0, sscanf(bus_id, "%x:%x.%x", &bus, &slot, &function) != 3))
+        return NVML_ERROR_INVALID_ARGUMENT;
+    simulate_latency();
+    if (slot == 0 && function == 0) {
+        for (unsigned int i = 0; i < mock.count; i++) {
+            if (mock.devices[i].domain == domain && mock.devices[i].bus == bus &&
+                device_present(&mock.devices[i])) {
+                *device = &mock.devices[i];
+                return NVML_SUCCESS;
+            }
+        }
+    }
+    return NVML_ERROR_NOT_FOUND;
+}
+
+nvmlReturn_t nvmlDeviceGetIndex(nvmlDevice_t device, unsigned int *index) {
+    nvmlReturn_t result = lookup(device);
+    if (result != NVML_SUCCESS) return result;
+    if (!index) return NVML_ERROR_INVALID_ARGUMENT;
+    *index = 0;
+    for (const struct nvmlDevice_st *dev = mock.devices; dev < device; dev++)
+        *index += device_present(dev);
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetUUID(nvmlDevice_t device, char *uuid, unsigned int length) {
+    nvmlReturn_t result = lookup(device);
+    if (result != NVML_SUCCESS) return result;
+    if (!uuid) return NVML_ERROR_INVALID_ARGUMENT;
+    if (length <= strlen(device->uuid)) return NVML_ERROR_INSUFFICIENT_SIZE;
+    strcpy(uuid, device->uuid);
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetTemperature(nvmlDevice_t device,
+                                      nvmlTemperatureSensors_t sensor,
+                                      unsigned int *temp) {
+    nvmlReturn_t result = lookup(device);
+    if (result != NVML_SUCCESS) return result;
+    if (sensor != NVML_TEMPERATURE_GPU || !temp) return NVML_ERROR_INVALID_ARGUMENT;
+
+    pthread_mutex_lock(&mock.lock);
+    update_device(device);
+    *temp = device->core_reading;
+    pthread_mutex_unlock(&mock.lock);
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetUtilizationRates(nvmlDevice_t device, nvmlUtilization_t *utilization) {
+    nvmlReturn_t result = lookup(device);
+    if (result != NVML_SUCCESS) return result;
+    if (!utilization) return NVML_ERROR_INVALID_ARGUMENT;
+
+    pthread_mutex_lock(&mock.lock);
+    update_device(device);
+    utilization->gpu = (unsigned int)lround(device->load * 100);
+    utilization->memory = utilization->gpu / 2;
+    pthread_mutex_unlock(&mock.lock);
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetPowerUsage(nvmlDevice_t device, unsigned int *power) {
+    nvmlReturn_t result = lookup(device);
+    if (result != NVML_SUCCESS) return result;
+    if (!power) return NVML_ERROR_INVALID_ARGUMENT;
+
+    pthread_mutex_lock(&mock.lock);
+    update_device(device);
+    *power = (unsigned int)lround(device->power * 1000);
+    pthread_mutex_unlock(&mock.lock);
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetEnforcedPowerLimit(nvmlDevice_t device, unsigned int *limit) {
+    nvmlReturn_t result = lookup(device);
+    if (result != NVML_SUCCESS) return result;
+    if (!limit) return NVML_ERROR_INVALID_ARGUMENT;
+    *limit = (unsigned int)(MOCK_MAX_POWER * 1000);
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetTotalEccErrors(nvmlDevice_t device, nvmlMemoryErrorType_t error_type,
+                                         nvmlEccCounterType_t counter_type,
+                                         unsigned long long *count) {
+    nvmlReturn_t result = lookup(device);
+    if (result != NVML_SUCCESS) return result;
+    if (!count) return NVML_ERROR_INVALID_ARGUMENT;
+    if (mock.ecc_rate < 0) return NVML_ERROR_NOT_SUPPORTED;
+    (void)counter_type;
+
+    pthread_mutex_lock(&mock.lock);
+    update_device(device);
+    *count = error_type == NVML_MEMORY_ERROR_TYPE_CORRECTED ?
+        (unsigned long long)device->ecc_errors : 0;
+    pthread_mutex_unlock(&mock.lock);
+    return NVML_SUCCESS;
+}
+
+nvmlReturn_t nvmlDeviceGetRemappedRows(nvmlDevice_t device, unsigned int *correctable,
+                                       unsigned int *uncorrectable, unsigned int *pending,
+                                       unsigned int *failed) {
+    nvmlReturn_t result = lookup(device);
+    if (result != NVML_SUCCESS) return result;
+    if (!correctable || !uncorrectable || !pending || !failed) return NVML_ERROR_INVALID_ARGUMENT;
+    if (mock.ecc_rate < 0) return NVML_ERROR_NOT_SUPPORTED;
+
+    pthread_mutex_lock(&mock.lock);
+    update_device(device);
+    *correctable = (unsigned int)(device->ecc_errors / MOCK_ECC_PER_ROW);
+    *uncorrectable = 0;
+    *pending = 0;
+    *failed = 0;
+    pthread_mutex_unlock(&mock.lock);
+    return NVML_SUCCESS;
+}